@@ -3,13 +3,100 @@
 
 #include "regex.h"
 #include "regex_builder.h"
+#include <algorithm>
 #include <boost/regex.hpp>
 #include <iostream>
+#include <latch>
 #include <print>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Runs is_match on a short haystack from 1 to 128 threads at once. The search
+// itself is cheap, so this mostly measures how the match data pool holds up
+// under contention.
+static void bench_pool_contention()
+{
+	static constexpr auto pattern = L"(\\d+)-(\\d+)-(\\d+)";
+	static constexpr auto haystack = L"id=12-34-56;";
+	static constexpr auto iterations = 100000;
+	const auto regex = pcre2::wregex::jit_compile(pattern);
+
+	for (auto threads = 1; threads <= 128; threads *= 2)
+	{
+		std::latch ready(threads + 1);
+		std::vector<std::jthread> workers;
+		for (auto t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&]
+				{
+					ready.arrive_and_wait();
+					for (auto i = 0; i < iterations; i++)
+					{
+						auto rc = regex->is_match(haystack);
+						assert(rc && *rc);
+					}
+				});
+		}
+
+		ready.arrive_and_wait();
+		auto start = std::chrono::high_resolution_clock::now();
+		workers.clear();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		auto searches = static_cast<double>(threads) * iterations;
+		std::println("{0:>3} threads: {1:.1f} Msearch/s", threads, searches * 1000 / time);
+	}
+}
+
+// Runs find_iter over a subject of about 90KB with and without a captureless
+// variant of the pattern, with the interpreter and with the JIT.
+static void bench_captureless()
+{
+	static constexpr auto pattern = L"(\\w+)@(\\w+)\\.(\\w+)\\.(com|org)";
+	static constexpr auto iterations = 100;
+
+	std::wstring haystack;
+	while (haystack.size() < 90 * 1024)
+	{
+		haystack += L"some text around alice@mail.example.com and bob@lists.example.org, ";
+	}
+
+	for (auto jit : { false, true })
+	{
+		for (auto captureless : { false, true })
+		{
+			auto options = pcre2::RegexOptions{};
+			options.jit(jit).captureless(captureless);
+			const auto regex = pcre2::wregex::jit_compile(pattern, options);
+
+			size_t matches = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (auto i = 0; i < iterations; i++)
+			{
+				for (const auto& m : regex->find_iter(haystack))
+				{
+					assert(m.has_value());
+					matches += 1;
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			auto time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+			std::println("jit={0} captureless={1}: {2} us ({3} matches)", jit, captureless, time / iterations, matches / iterations);
+		}
+	}
+}
 
 // https://github.com/Homebrodot/Godot/blob/5eccbcefabba0f6ead2294877db3ff4a92ece068/modules/regex/regex.cpp#L374
-int main() 
+int main(int argc, char* argv[])
 {
+	auto flag = [&](std::string_view name)
+		{
+			return std::find(argv + 1, argv + argc, name) != argv + argc;
+		};
+
 	try 
 	{
 		static constexpr auto pattern = L"(\\d+)-(\\d+)-(\\d+)";
@@ -41,6 +128,34 @@ int main()
 		time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 		std::println("boost {0}ms", time);
 
+		// A quantifier after \E repeats the last quoted character only, so
+		// the prefilter must not require "abc" here.
+		{
+			const auto quoted = pcre2::wregex::jit_compile(L"\\Qab\\E+c");
+			auto rc = quoted->is_match(L"abbc");
+			assert(rc && *rc);
+		}
+
+		// PCRE2 10.43 reads `{ 2 }` as a quantifier and older versions as
+		// literal text. Either way exactly one of these subjects matches, so
+		// the prefilter must not rule out both.
+		{
+			const auto spaced = pcre2::wregex::jit_compile(L"xa{ 2 }y");
+			auto quantified = spaced->is_match(L"xaay");
+			auto literal = spaced->is_match(L"xa{ 2 }y");
+			assert(quantified && literal && *quantified != *literal);
+		}
+
+		if (flag("--bench-pool"))
+		{
+			bench_pool_contention();
+		}
+
+		if (flag("--bench-captureless"))
+		{
+			bench_captureless();
+		}
+
 		for (const auto& view : regex->splitn(text, 5)) 
 		{
 			if (view.has_value())
@@ -0,0 +1,364 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/*!
+Allocators PCRE2 can be told to use instead of `malloc` and `free`.
+
+PCRE2 takes its memory functions from a general context. Everything created
+with that context, directly or through a context created from it, allocates
+through them: compiled code, compile and match contexts, match data, the
+heap frames of the interpreter and the control block of a JIT stack. Setting
+`RegexOptions::allocator` builds such a context for a regex, see
+`GeneralContext`.
+
+PCRE2 only passes a pointer to `free`, so allocators that need the size of a
+block keep it in a small header in front of it. Blocks are aligned like
+`malloc` aligns them, which is all PCRE2 asks for.
+*/
+
+namespace pcre2 {
+
+	/// Memory for PCRE2.
+	///
+	/// Match data is used from whichever thread runs a search, so both
+	/// functions may be called from several threads at once.
+	struct Allocator
+	{
+		virtual ~Allocator() = default;
+
+		/// Returns `size` bytes aligned for any type, or `nullptr` when out of
+		/// memory. PCRE2 reports the failure itself.
+		virtual auto allocate(size_t size) noexcept -> void* = 0;
+
+		/// Gives back a block returned by `allocate`.
+		virtual void deallocate(void* ptr) noexcept = 0;
+	};
+
+	/// `malloc` and `free`, which is what PCRE2 uses without an allocator.
+	struct SystemAllocator final : Allocator
+	{
+		auto allocate(size_t size) noexcept -> void* override
+		{
+			return std::malloc(size);
+		}
+
+		void deallocate(void* ptr) noexcept override
+		{
+			std::free(ptr);
+		}
+
+		/// The one instance, for allocators that wrap another one.
+		static auto shared() -> std::shared_ptr<Allocator>
+		{
+			static auto instance = std::make_shared<SystemAllocator>();
+			return instance;
+		}
+	};
+
+	namespace inner {
+		/// The size of a block, in front of the block.
+		struct alignas(std::max_align_t) BlockHeader
+		{
+			size_t size;
+			bool mapped;
+		};
+	}
+
+	/// Hands out memory by bumping a pointer through large chunks and never
+	/// frees a single block.
+	///
+	/// This suits batch jobs: build the regexes of a batch with the arena,
+	/// run the batch, drop the regexes and `reset` the arena for the next
+	/// one. Every block of a batch then goes away in one step, and the next
+	/// batch reuses the first chunk instead of asking the system again.
+	///
+	/// Everything allocated from the arena must be gone before `reset` is
+	/// called, including scratch spaces and capture locations.
+	class BumpAllocator final : public Allocator
+	{
+	public:
+		explicit BumpAllocator(size_t chunk_size = static_cast<size_t>(1) << 20)
+			: chunk_size(round_up(std::max<size_t>(chunk_size, 4096)))
+		{
+		}
+
+		auto allocate(size_t size) noexcept -> void* override
+		{
+			size = round_up(std::max<size_t>(size, 1));
+			auto lock = std::lock_guard(mutex);
+			if (chunks.empty() || offset + size > chunks.back().size) {
+				// Blocks bigger than a chunk get one of their own, which
+				// goes in front of the current chunk so its free space
+				// isn't lost.
+				auto len = std::max(size, chunk_size);
+				auto memory = std::unique_ptr<std::byte[]>(new (std::nothrow) std::byte[len]);
+				if (!memory) {
+					return nullptr;
+				}
+				if (size > chunk_size && !chunks.empty()) {
+					chunks.insert(chunks.end() - 1, Chunk{ std::move(memory), len });
+					in_use += size;
+					return (chunks.end() - 2)->memory.get();
+				}
+				chunks.push_back(Chunk{ std::move(memory), len });
+				offset = 0;
+			}
+			auto ptr = chunks.back().memory.get() + offset;
+			offset += size;
+			in_use += size;
+			return ptr;
+		}
+
+		void deallocate(void*) noexcept override
+		{
+		}
+
+		/// Drops every block at once and keeps the first chunk for what comes
+		/// next.
+		void reset(this BumpAllocator& self) noexcept
+		{
+			auto lock = std::lock_guard(self.mutex);
+			auto keep = std::find_if(self.chunks.begin(), self.chunks.end(), [&](const Chunk& chunk)
+				{
+					return chunk.size == self.chunk_size;
+				});
+			if (keep != self.chunks.end()) {
+				auto chunk = std::move(*keep);
+				self.chunks.clear();
+				self.chunks.push_back(std::move(chunk));
+			}
+			else {
+				self.chunks.clear();
+			}
+			self.offset = 0;
+			self.in_use = 0;
+		}
+
+		/// The number of bytes handed out since the last `reset`.
+		auto used(this const BumpAllocator& self) noexcept -> size_t
+		{
+			auto lock = std::lock_guard(self.mutex);
+			return self.in_use;
+		}
+
+		/// The number of bytes the arena holds on to.
+		auto reserved(this const BumpAllocator& self) noexcept -> size_t
+		{
+			auto lock = std::lock_guard(self.mutex);
+			size_t total = 0;
+			for (const auto& chunk : self.chunks) {
+				total += chunk.size;
+			}
+			return total;
+		}
+
+	private:
+		struct Chunk
+		{
+			std::unique_ptr<std::byte[]> memory;
+			size_t size;
+		};
+
+		static constexpr auto round_up(size_t size) noexcept -> size_t
+		{
+			constexpr size_t align = alignof(std::max_align_t);
+			return (size + align - 1) & ~(align - 1);
+		}
+
+		mutable std::mutex mutex;
+		std::vector<Chunk> chunks;
+		size_t chunk_size;
+		size_t offset = 0;
+		size_t in_use = 0;
+	};
+
+	/// Backs large blocks with huge pages.
+	///
+	/// The blocks that get large are the heap frames of the interpreter,
+	/// which grow with backtracking, and big match data. A block of at least
+	/// `threshold` bytes is mapped on its own and rounded up to whole huge
+	/// pages, so it costs few TLB entries; anything smaller goes to `backing`.
+	///
+	/// On Linux the pages come from the `hugetlbfs` pool when one is set up
+	/// and otherwise are transparent huge pages, asked for with `madvise`. On
+	/// Windows they are large pages, which needs `SeLockMemoryPrivilege`;
+	/// without it the block is mapped with normal pages. Elsewhere every
+	/// block goes to `backing`.
+	///
+	/// The memory of a JIT stack itself is mapped by PCRE2 and doesn't go
+	/// through an allocator, only its control block does.
+	class HugePageAllocator final : public Allocator
+	{
+	public:
+		explicit HugePageAllocator(
+			size_t threshold = static_cast<size_t>(1) << 20,
+			std::shared_ptr<Allocator> backing = SystemAllocator::shared()
+		) : threshold(threshold), backing(std::move(backing)), page_size(huge_page_size())
+		{
+		}
+
+		auto allocate(size_t size) noexcept -> void* override
+		{
+			constexpr auto header = sizeof(inner::BlockHeader);
+			if (size >= threshold && page_size != 0) {
+				auto len = (size + header + page_size - 1) / page_size * page_size;
+				if (auto block = map(len)) {
+					return new (block) inner::BlockHeader{ len, true } + 1;
+				}
+			}
+			auto block = backing->allocate(size + header);
+			if (!block) {
+				return nullptr;
+			}
+			return new (block) inner::BlockHeader{ size + header, false } + 1;
+		}
+
+		void deallocate(void* ptr) noexcept override
+		{
+			if (!ptr) {
+				return;
+			}
+			auto block = static_cast<inner::BlockHeader*>(ptr) - 1;
+			if (block->mapped) {
+				unmap(block, block->size);
+			}
+			else {
+				backing->deallocate(block);
+			}
+		}
+
+	private:
+		static auto huge_page_size() noexcept -> size_t
+		{
+#if defined(_WIN32)
+			return ::GetLargePageMinimum();
+#elif defined(__linux__)
+			return static_cast<size_t>(2) << 20;
+#else
+			return 0;
+#endif
+		}
+
+		auto map(size_t len) const noexcept -> void*
+		{
+#if defined(_WIN32)
+			if (auto block = ::VirtualAlloc(nullptr, len, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE)) {
+				return block;
+			}
+			return ::VirtualAlloc(nullptr, len, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#elif defined(__linux__)
+			auto block = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (block != MAP_FAILED) {
+				return block;
+			}
+			block = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (block == MAP_FAILED) {
+				return nullptr;
+			}
+			::madvise(block, len, MADV_HUGEPAGE);
+			return block;
+#else
+			(void)len;
+			return nullptr;
+#endif
+		}
+
+		static void unmap(void* block, size_t len) noexcept
+		{
+#if defined(_WIN32)
+			(void)len;
+			::VirtualFree(block, 0, MEM_RELEASE);
+#elif defined(__linux__)
+			::munmap(block, len);
+#else
+			(void)block;
+			(void)len;
+#endif
+		}
+
+		size_t threshold;
+		std::shared_ptr<Allocator> backing;
+		size_t page_size;
+	};
+
+	/// Keeps count of the memory going through another allocator.
+	///
+	/// Give each regex its own `CountingAllocator` to see how much memory
+	/// it uses: its compiled code, its match data pools and everything its
+	/// searches allocate. The counts are updated with relaxed atomics, so
+	/// they can be read while searches run.
+	class CountingAllocator final : public Allocator
+	{
+	public:
+		explicit CountingAllocator(std::shared_ptr<Allocator> backing = SystemAllocator::shared())
+			: backing(std::move(backing))
+		{
+		}
+
+		auto allocate(size_t size) noexcept -> void* override
+		{
+			constexpr auto header = sizeof(inner::BlockHeader);
+			auto block = backing->allocate(size + header);
+			if (!block) {
+				return nullptr;
+			}
+			current.fetch_add(size, std::memory_order_relaxed);
+			count.fetch_add(1, std::memory_order_relaxed);
+			auto now = current.load(std::memory_order_relaxed);
+			auto high = peak.load(std::memory_order_relaxed);
+			while (now > high && !peak.compare_exchange_weak(high, now, std::memory_order_relaxed)) {
+			}
+			return new (block) inner::BlockHeader{ size, false } + 1;
+		}
+
+		void deallocate(void* ptr) noexcept override
+		{
+			if (!ptr) {
+				return;
+			}
+			auto block = static_cast<inner::BlockHeader*>(ptr) - 1;
+			current.fetch_sub(block->size, std::memory_order_relaxed);
+			backing->deallocate(block);
+		}
+
+		/// The number of bytes currently allocated.
+		auto bytes(this const CountingAllocator& self) noexcept -> size_t
+		{
+			return self.current.load(std::memory_order_relaxed);
+		}
+
+		/// The most bytes that were allocated at any one time.
+		auto peak_bytes(this const CountingAllocator& self) noexcept -> size_t
+		{
+			return self.peak.load(std::memory_order_relaxed);
+		}
+
+		/// The number of allocations made so far.
+		auto allocations(this const CountingAllocator& self) noexcept -> size_t
+		{
+			return self.count.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::shared_ptr<Allocator> backing;
+		std::atomic<size_t> current = 0;
+		std::atomic<size_t> peak = 0;
+		std::atomic<size_t> count = 0;
+	};
+}
@@ -0,0 +1,93 @@
+﻿#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace pcre2 {
+
+	/// The offsets of one capture group in a batch of subjects. See
+	/// `CaptureColumns`.
+	template<typename CharT>
+	struct CaptureColumn
+	{
+		/// The name of the group, or empty if it doesn't have one.
+		std::basic_string<CharT> name;
+		/// Where the group starts and ends in every subject, one pair per
+		/// row: `offsets[2 * row]` and `offsets[2 * row + 1]`. Both are 0
+		/// when the group didn't take part in the match.
+		std::vector<uint32_t> offsets;
+		/// Bit `row % 64` of `valid[row / 64]` is set when the group took
+		/// part in the match of subject `row`.
+		std::vector<uint64_t> valid;
+
+		inline auto is_valid(this const CaptureColumn& self, size_t row) noexcept -> bool
+		{
+			return (self.valid[row / 64] >> (row % 64)) & 1;
+		}
+
+		/// Returns the offsets of the group in subject `row`, or nothing if
+		/// it didn't take part in the match.
+		auto get(this const CaptureColumn& self, size_t row) noexcept -> std::optional<std::tuple<size_t, size_t>>
+		{
+			if (!self.is_valid(row)) {
+				return std::nullopt;
+			}
+			return std::make_optional<std::tuple<size_t, size_t>>(self.offsets[2 * row], self.offsets[2 * row + 1]);
+		}
+	};
+
+	/// The capture groups of a regex in a batch of subjects, stored by
+	/// group rather than by subject, as filled in by
+	/// `basic_regex::extract_columns`.
+	///
+	/// There is a column for every group, with the whole match in the
+	/// first one. A subject without a match has no valid group, so the
+	/// first column also tells which subjects matched. Filling the same
+	/// `CaptureColumns` again reuses its memory.
+	template<typename CharT>
+	struct CaptureColumns
+	{
+		/// The number of subjects.
+		size_t rows = 0;
+		/// One column per group, in group order.
+		std::vector<CaptureColumn<CharT>> columns;
+
+		/// Returns the index of the column of the group named `name`.
+		auto index(this const CaptureColumns& self, std::basic_string_view<CharT> name) noexcept -> std::optional<size_t>
+		{
+			for (size_t i = 0; i < self.columns.size(); i++) {
+				if (!name.empty() && self.columns[i].name == name) {
+					return i;
+				}
+			}
+			return std::nullopt;
+		}
+
+		/// Returns the column of the group named `name`.
+		auto column(this const CaptureColumns& self, std::basic_string_view<CharT> name) noexcept -> const CaptureColumn<CharT>*
+		{
+			auto i = self.index(name);
+			return i ? &self.columns[*i] : nullptr;
+		}
+
+		/// Clears every column and makes room for `rows` subjects, with one
+		/// column for each of `names`.
+		void reset(this CaptureColumns& self, std::span<const std::basic_string<CharT>> names, size_t rows)
+		{
+			self.rows = rows;
+			self.columns.resize(names.size());
+			for (size_t i = 0; i < names.size(); i++) {
+				auto& column = self.columns[i];
+				if (column.name != names[i]) {
+					column.name = names[i];
+				}
+				column.offsets.assign(2 * rows, 0);
+				column.valid.assign((rows + 63) / 64, 0);
+			}
+		}
+	};
+}
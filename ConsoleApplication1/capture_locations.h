@@ -5,14 +5,40 @@
 #include "match_data.h"
 #include <optional>
 #include <pcre2.h>
+#include <span>
+#include <tuple>
 
 namespace pcre2 {
+	/// Returns the offsets of the `i`th capture group in the given ovector, or
+	/// nothing if that group didn't participate in the match.
+	inline auto capture_at(std::span<const size_t> ovec, size_t i) noexcept -> std::optional<std::tuple<size_t, size_t>>
+	{
+		size_t index = i * 2;
+		if (index < ovec.size())
+		{
+			if (auto s = ovec[index]; s != PCRE2_UNSET)
+			{
+				index = i * 2 + 1;
+				if (index < ovec.size())
+				{
+					if (auto e = ovec[index]; e != PCRE2_UNSET)
+					{
+						return std::make_optional<std::tuple<size_t, size_t>>(s, e);
+					}
+				}
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	template<typename CharT>
 	struct CaptureLocations
 	{
-		Code* code;
-		std::unique_ptr<MatchData> data;
+		Code<CharT>* code;
+		std::unique_ptr<MatchData<CharT>> data;
 
-		CaptureLocations(Code* code, std::unique_ptr<MatchData> data) noexcept : code(code), data(std::move(data)) {}
+		CaptureLocations(Code<CharT>* code, std::unique_ptr<MatchData<CharT>> data) noexcept : code(code), data(std::move(data)) {}
 
 		CaptureLocations(const CaptureLocations& rhs) = delete;
 
@@ -25,24 +51,7 @@ namespace pcre2 {
 
 		auto get(this const CaptureLocations& self, size_t i) noexcept -> std::optional<std::tuple<size_t, size_t>>
 		{
-			auto ovec = self.data->ovector();
-			size_t index = i * 2;
-			if (index < ovec.size())
-			{
-				if (auto s = ovec[index]; s != PCRE2_UNSET)
-				{
-					index = i * 2 + 1;
-					if (index < ovec.size())
-					{
-						if (auto e = ovec[index]; e != PCRE2_UNSET)
-						{
-							return std::make_optional<std::tuple<size_t, size_t>>(s, e);
-						}
-					}
-				}
-			}
-
-			return std::nullopt;
+			return capture_at(self.data->ovector(), i);
 		}
 
 		inline auto len(this const CaptureLocations& self) noexcept -> size_t
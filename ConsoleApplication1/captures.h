@@ -2,20 +2,122 @@
 #include "capture_locations.h"
 #include "config.h"
 #include <map>
+#include <span>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace pcre2 {
+	template<typename CharT>
+	struct OwnedCaptures;
+
+	/// A borrowed view of the capture groups of a single match.
+	///
+	/// This points directly into the ovector of a `MatchData` owned by someone
+	/// else (for example the pooled `MatchData` borrowed by
+	/// `captures_iter_ref`), so creating one costs nothing. It is only valid
+	/// until the next search that uses the same `MatchData`. Use `to_owned`
+	/// to keep the result.
+	template<typename CharT>
+	struct CapturesRef
+	{
+		const CharT* subject;
+		std::span<const size_t> ovector;
+		const std::map<std::basic_string<CharT>, size_t, std::less<void>>* idx;
+
+		auto get(this const CapturesRef& self, size_t i) noexcept -> std::optional<Match<CharT>>
+		{
+			return capture_at(self.ovector, i).transform([&](auto v) { auto& [s, e] = v; return Match<CharT>{ self.subject, s, e }; });
+		}
+
+		auto name(this const CapturesRef& self, std::basic_string_view<CharT> name) -> std::optional<Match<CharT>>
+		{
+			if (auto iter = self.idx->find(name); iter != self.idx->end()) {
+				return self.get(iter->second);
+			}
+			return std::nullopt;
+		}
+
+		auto operator[](this const CapturesRef& self, int i) -> std::basic_string_view<CharT>
+		{
+			return self.get(i)
+				.transform([](const auto& m) { return m.as_view(); }).value();
+		}
+
+		auto operator[](this const CapturesRef& self, const CharT* name) -> std::basic_string_view<CharT>
+		{
+			return self.name(name)
+				.transform([](const auto& m) { return m.as_view(); }).value();
+		}
+
+		inline auto len(this const CapturesRef& self) noexcept -> size_t
+		{
+			return self.ovector.size() / 2;
+		}
+
+		/// Copies the capture offsets so the result outlives the `MatchData`
+		/// this view borrows from. The subject is not copied.
+		auto to_owned(this const CapturesRef& self) -> OwnedCaptures<CharT>
+		{
+			return OwnedCaptures<CharT>{
+				self.subject,
+				std::vector<size_t>(self.ovector.begin(), self.ovector.end()),
+				self.idx
+			};
+		}
+	};
+
+	/// The capture groups of a single match, holding a copy of the offsets
+	/// only. Unlike `Captures`, this doesn't keep a `MatchData` alive.
+	template<typename CharT>
+	struct OwnedCaptures
+	{
+		const CharT* subject;
+		std::vector<size_t> offsets;
+		const std::map<std::basic_string<CharT>, size_t, std::less<void>>* idx;
+
+		inline auto as_ref(this const OwnedCaptures& self) noexcept -> CapturesRef<CharT>
+		{
+			return CapturesRef<CharT>{ self.subject, self.offsets, self.idx };
+		}
+
+		auto get(this const OwnedCaptures& self, size_t i) noexcept -> std::optional<Match<CharT>>
+		{
+			return self.as_ref().get(i);
+		}
+
+		auto name(this const OwnedCaptures& self, std::basic_string_view<CharT> name) -> std::optional<Match<CharT>>
+		{
+			return self.as_ref().name(name);
+		}
+
+		auto operator[](this const OwnedCaptures& self, int i) -> std::basic_string_view<CharT>
+		{
+			return self.as_ref()[i];
+		}
+
+		auto operator[](this const OwnedCaptures& self, const CharT* name) -> std::basic_string_view<CharT>
+		{
+			return self.as_ref()[name];
+		}
+
+		inline auto len(this const OwnedCaptures& self) noexcept -> size_t
+		{
+			return self.offsets.size() / 2;
+		}
+	};
+
+	template<typename CharT>
 	struct Captures
 	{
-		const wchar_t* subject;
-		CaptureLocations locs;
-		const std::map<std::wstring, size_t, std::less<void>>* idx;
+		const CharT* subject;
+		CaptureLocations<CharT> locs;
+		const std::map<std::basic_string<CharT>, size_t, std::less<void>>* idx;
 
 		Captures(
-			const wchar_t* subject,
-			CaptureLocations locs,
-			const std::map<std::wstring, size_t, std::less<void>>* idx) noexcept
+			const CharT* subject,
+			CaptureLocations<CharT> locs,
+			const std::map<std::basic_string<CharT>, size_t, std::less<void>>* idx) noexcept
 			: subject(subject), locs(std::move(locs)), idx(idx) {
 		}
 
@@ -23,12 +125,12 @@ namespace pcre2 {
 		Captures(Captures&& rhs) noexcept : subject(rhs.subject), locs(std::move(rhs.locs)), idx(rhs.idx) {}
 		Captures operator=(Captures&& rhs) noexcept { return Captures(std::move(rhs)); }
 
-		auto get(this const Captures& self, size_t i) noexcept -> std::optional<Match>
+		auto get(this const Captures& self, size_t i) noexcept -> std::optional<Match<CharT>>
 		{
-			return self.locs.get(i).transform([&](auto v) { auto& [s, e] = v; return Match(self.subject, s, e); });
+			return self.locs.get(i).transform([&](auto v) { auto& [s, e] = v; return Match<CharT>{ self.subject, s, e }; });
 		}
 
-		auto name(this const Captures& self, std::wstring_view name) -> std::optional<Match>
+		auto name(this const Captures& self, std::basic_string_view<CharT> name) -> std::optional<Match<CharT>>
 		{
 			if (auto iter = self.idx->find(name); iter != self.idx->end()) {
 				return self.get(iter->second);
@@ -36,14 +138,14 @@ namespace pcre2 {
 			return std::nullopt;
 		}
 
-		auto operator[](this const Captures& self, int i) -> std::wstring_view
+		auto operator[](this const Captures& self, int i) -> std::basic_string_view<CharT>
 		{
 			return self.get(i)
 				.transform([](const auto& m) { return m.as_view(); }).value();
 			//.unwrap_or_else(|| panic!("no group at index '{}'", i));
 		}
 
-		auto operator[](this const Captures& self, const wchar_t* name) -> std::wstring_view
+		auto operator[](this const Captures& self, const CharT* name) -> std::basic_string_view<CharT>
 		{
 			return self.name(name)
 				.transform([](const auto& m) { return m.as_view(); }).value();
@@ -54,5 +156,17 @@ namespace pcre2 {
 		{
 			return self.locs.len();
 		}
+
+		inline auto as_ref(this const Captures& self) noexcept -> CapturesRef<CharT>
+		{
+			return CapturesRef<CharT>{ self.subject, self.locs.data->ovector(), self.idx };
+		}
+
+		/// Copies the capture offsets, releasing the dependency on this
+		/// value's `MatchData`.
+		auto to_owned(this const Captures& self) -> OwnedCaptures<CharT>
+		{
+			return self.as_ref().to_owned();
+		}
 	};
 }
\ No newline at end of file
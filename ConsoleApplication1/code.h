@@ -3,34 +3,37 @@
 #define PCRE2_CODE_UNIT_WIDTH 0
 #include "compile_context.h"
 #include "error.h"
-#include <bit>
+#include "traits.h"
 #include <expected>
 #include <memory>
 #include <pcre2.h>
 #include <span>
+#include <string>
 #include <vector>
 
 namespace pcre2 {
+	template<typename CharT>
 	struct Code {
-		pcre2_code_16* code;
+		using code_type = typename traits<CharT>::code_type;
+
+		code_type* code;
 		bool compiled_jit;
-		std::unique_ptr<CompileContext> ctx;
+		std::unique_ptr<CompileContext<CharT>> ctx;
 
 		~Code() {
-			pcre2_code_free_16(code);
+			traits<CharT>::release(code);
 		}
 
 		static auto make_unique(
-			std::wstring_view pattern,
+			std::basic_string_view<CharT> pattern,
 			uint32_t options,
-			std::unique_ptr<CompileContext> ctx
+			std::unique_ptr<CompileContext<CharT>> ctx
 		) -> std::expected<std::unique_ptr<Code>, Error> {
 			int error_code = 0;
 			size_t error_offset = 0;
 			auto code =
-				pcre2_compile_16(
-					std::bit_cast<PCRE2_SPTR16>(pattern.data()),
-					pattern.size(),
+				traits<CharT>::compile(
+					pattern,
 					options,
 					&error_code,
 					&error_offset,
@@ -44,9 +47,12 @@ namespace pcre2 {
 			}
 		}
 
-		auto jit_compile(this Code& self) -> std::expected<void, Error>
+		/// JIT compiles the code for the modes in `options`, which may add
+		/// `PCRE2_JIT_PARTIAL_HARD` and `PCRE2_JIT_PARTIAL_SOFT`. Searches in
+		/// a mode that wasn't compiled fall back to the interpreter.
+		auto jit_compile(this Code& self, uint32_t options = PCRE2_JIT_COMPLETE) -> std::expected<void, Error>
 		{
-			auto error_code = pcre2_jit_compile_16(self.code, PCRE2_JIT_COMPLETE);
+			auto error_code = traits<CharT>::jit_compile(self.code, options);
 			if (error_code == 0) {
 				self.compiled_jit = true;
 				return {};
@@ -56,46 +62,46 @@ namespace pcre2 {
 			}
 		}
 
-		auto capture_names(this const Code& self) -> std::vector<std::wstring>
+		auto capture_names(this const Code& self) -> std::vector<std::basic_string<CharT>>
 		{
 			auto name_count = *self.name_count();
 			auto size = *self.name_entry_size();
-			std::span<const wchar_t> table(std::bit_cast<const wchar_t*>(*self.raw_name_table()), name_count * size);
+			std::span<const CharT> table(*self.raw_name_table(), name_count * size);
 
-			auto names = std::vector<std::wstring>();
+			auto names = std::vector<std::basic_string<CharT>>();
 			names.resize(*self.capture_count());
 			for (size_t i = 0; i < name_count; i++) {
-				auto entry = table.subspan(i * size, (i + 1) * size - i * size);
-				auto name = entry.subspan(1);
-				auto index = static_cast<uint32_t>(entry[0]);
-				names[index] = std::wstring(std::bit_cast<const wchar_t*>(name.data()));
+				auto entry = table.subspan(i * size, size);
+				auto name = entry.subspan(traits<CharT>::table_offset());
+				auto index = traits<CharT>::group_number(entry.data());
+				names[index] = std::basic_string<CharT>(name.data());
 			}
 
 			return names;
 		}
 
-		inline auto as_ptr(this const Code& self) noexcept -> const pcre2_code_16*
+		inline auto as_ptr(this const Code& self) noexcept -> const code_type*
 		{
 			return self.code;
 		}
 
-		explicit operator pcre2_code_16* (this const Code& self) noexcept
+		explicit operator code_type* (this const Code& self) noexcept
 		{
 			return self.code;
 		}
 
-		auto raw_name_table(this const Code& self) -> std::expected<const uint8_t*, Error>
+		auto raw_name_table(this const Code& self) -> std::expected<const CharT*, Error>
 		{
-			const uint8_t* bytes = nullptr;
-			auto rc = pcre2_pattern_info_16(
+			const CharT* table = nullptr;
+			auto rc = traits<CharT>::query(
 				self.as_ptr(),
 				PCRE2_INFO_NAMETABLE,
-				&bytes);
+				&table);
 			if (rc != 0) {
 				return std::unexpected(Error::info(rc));
 			}
 			else {
-				return bytes;
+				return table;
 			}
 		}
 
@@ -103,7 +109,7 @@ namespace pcre2 {
 		{
 			uint32_t count = 0;
 			auto rc =
-				pcre2_pattern_info_16(
+				traits<CharT>::query(
 					self.as_ptr(),
 					PCRE2_INFO_NAMECOUNT,
 					&count);
@@ -120,7 +126,7 @@ namespace pcre2 {
 		{
 			uint32_t size = 0;
 			auto rc =
-				pcre2_pattern_info_16(
+				traits<CharT>::query(
 					self.as_ptr(),
 					PCRE2_INFO_NAMEENTRYSIZE,
 					&size);
@@ -137,7 +143,7 @@ namespace pcre2 {
 		{
 			uint32_t count = 0;
 			auto rc =
-				pcre2_pattern_info_16(
+				traits<CharT>::query(
 					self.as_ptr(),
 					PCRE2_INFO_CAPTURECOUNT,
 					&count
@@ -150,5 +156,44 @@ namespace pcre2 {
 				return 1 + static_cast<size_t>(count);
 			}
 		}
+
+		/// The most characters any lookbehind in the pattern looks back, which
+		/// includes the one character `\b` and `\B` look at.
+		auto max_lookbehind(this const Code& self) -> std::expected<size_t, Error>
+		{
+			uint32_t max = 0;
+			auto rc =
+				traits<CharT>::query(
+					self.as_ptr(),
+					PCRE2_INFO_MAXLOOKBEHIND,
+					&max
+				);
+
+			if (rc != 0) {
+				return std::unexpected(Error::info(rc));
+			}
+			else {
+				return static_cast<size_t>(max);
+			}
+		}
+
+		/// The highest back reference in the pattern, or zero if it has none.
+		auto backref_max(this const Code& self) -> std::expected<size_t, Error>
+		{
+			uint32_t max = 0;
+			auto rc =
+				traits<CharT>::query(
+					self.as_ptr(),
+					PCRE2_INFO_BACKREFMAX,
+					&max
+				);
+
+			if (rc != 0) {
+				return std::unexpected(Error::info(rc));
+			}
+			else {
+				return static_cast<size_t>(max);
+			}
+		}
 	};
 }
\ No newline at end of file
@@ -4,17 +4,27 @@
 #define PCRE2_CODE_UNIT_WIDTH 0
 #include <pcre2.h>
 #include <expected>
+#include <memory>
 #include "error.h"
+#include "general_context.h"
+#include "traits.h"
 
 namespace pcre2 {
 
+	template<typename CharT>
 	struct CompileContext
 	{
-		pcre2_compile_context_16* context;
+		using context_type = typename traits<CharT>::compile_context_type;
 
-		CompileContext()
+		context_type* context;
+		/// Where the compiled code gets its memory, if not from `malloc`. It
+		/// is kept alive for the code, which frees through it.
+		std::shared_ptr<GeneralContext<CharT>> general_context;
+
+		explicit CompileContext(std::shared_ptr<GeneralContext<CharT>> general_context = nullptr)
+			: general_context(std::move(general_context))
 		{
-			auto ctx = pcre2_compile_context_create_16(nullptr);
+			auto ctx = traits<CharT>::compile_context_create(general_context_ptr(this->general_context));
 			assert(ctx, "could not allocate compile context");
 			context = ctx;
 		}
@@ -23,22 +33,29 @@ namespace pcre2 {
 
 		~CompileContext()
 		{
-			pcre2_compile_context_free_16(context);
+			traits<CharT>::compile_context_free(context);
 		}
 
-		explicit operator pcre2_compile_context_16* (this const CompileContext& self) noexcept
+		explicit operator context_type* (this const CompileContext& self) noexcept
 		{
 			return self.context;
 		}
 
-		inline auto as_mut_ptr(this const CompileContext& self) noexcept -> pcre2_compile_context_16*
+		inline auto as_mut_ptr(this const CompileContext& self) noexcept -> context_type*
 		{
 			return self.context;
 		}
 
+		/// The raw general context, or `nullptr` for PCRE2's default one.
+		static auto general_context_ptr(const std::shared_ptr<GeneralContext<CharT>>& general_context) noexcept
+			-> typename GeneralContext<CharT>::context_type*
+		{
+			return general_context ? general_context->as_mut_ptr() : nullptr;
+		}
+
 		auto set_newline(this const CompileContext& self, uint32_t value) -> std::expected<void, Error>
 		{
-			auto rc = pcre2_set_newline_16(self.context, value);
+			auto rc = traits<CharT>::set_newline(self.context, value);
 			if (rc == 0) {
 				return {};
 			}
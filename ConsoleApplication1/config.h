@@ -1,5 +1,13 @@
 ﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include "allocator.h"
+#include "pool.h"
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <pcre2.h>
+#include <string>
 #include <string_view>
 
 namespace pcre2 {
@@ -14,11 +22,43 @@ namespace pcre2 {
 		Attempt,
 	};
 
+	enum class MatchEngine
+	{
+		/// pcre2_match, JIT compiled or not. It reports capture groups and
+		/// the match Perl would find, but may backtrack for a time
+		/// exponential in the length of the subject.
+		Backtrack,
+		/// pcre2_dfa_match. It doesn't backtrack, so its running time grows
+		/// polynomially with the length of the subject where backtracking
+		/// can grow exponentially. It reports the longest match at the
+		/// leftmost position and no capture groups, and doesn't support
+		/// backreferences.
+		Dfa,
+	};
+
 	struct MatchConfig
 	{
+		/// Which PCRE2 matcher runs searches.
+		MatchEngine engine = MatchEngine::Backtrack;
 		/// When set, a custom JIT stack will be created with the given maximum
 		/// size.
 		std::optional<size_t> max_jit_stack_size;
+		/// How threads that don't own the match data pool pick a stack in it.
+		ShardPolicy shards = ShardPolicy::Thread;
+		/// Borrow match data from the calling thread's `ScratchArena` instead
+		/// of giving the regex a pool of its own.
+		bool shared_scratch = false;
+		/// PCRE2_MATCH_LIMIT: how many times the matcher may backtrack.
+		std::optional<uint32_t> match_limit;
+		/// PCRE2_DEPTH_LIMIT: how deep backtracking may nest. The JIT
+		/// ignores it.
+		std::optional<uint32_t> depth_limit;
+		/// PCRE2_HEAP_LIMIT: how much heap, in KiB, the interpreter may use
+		/// for backtracking. The JIT ignores it.
+		std::optional<uint32_t> heap_limit;
+		/// When a search runs into a limit, run it again with the DFA
+		/// matcher, which doesn't backtrack. See `MatchData::find_dfa`.
+		bool dfa_fallback = false;
 	};
 
 	struct Config {
@@ -36,10 +76,24 @@ namespace pcre2 {
 		bool ucp;
 		/// PCRE2_UTF
 		bool utf;
+		/// PCRE2_LITERAL
+		bool literal;
+		/// Also compile the pattern with PCRE2_NO_AUTO_CAPTURE for searches
+		/// that only need the overall match.
+		bool captureless;
+		/// Also compile the pattern with PCRE2_AUTO_CALLOUT, so that searches
+		/// with a deadline or a cancellation token can be stopped midway.
+		bool interruptible;
+		/// Also JIT compile for PCRE2_PARTIAL_HARD, which `StreamMatcher`
+		/// searches with.
+		bool streaming;
 		/// use pcre2_jit_compile
 		JITChoice jit;
 		/// Match-time specific configuration knobs.
 		MatchConfig match_config;
+		/// Where PCRE2 gets memory for the code and its match data. `malloc`
+		/// when unset.
+		std::shared_ptr<Allocator> allocator;
 
 		Config() noexcept
 			: caseless(false)
@@ -49,31 +103,102 @@ namespace pcre2 {
 			, crlf(false)
 			, ucp(false)
 			, utf(false)
+			, literal(false)
+			, captureless(false)
+			, interruptible(false)
+			, streaming(false)
 			, jit(JITChoice::Never) {
 
 		}
+
+		/// The PCRE2 compile options corresponding to this configuration.
+		auto compile_options(this const Config& self) noexcept -> uint32_t
+		{
+			uint32_t options = 0;
+			if (self.caseless) {
+				options |= PCRE2_CASELESS;
+			}
+			if (self.dotall) {
+				options |= PCRE2_DOTALL;
+			}
+			if (self.extended) {
+				options |= PCRE2_EXTENDED;
+			}
+			if (self.multi_line) {
+				options |= PCRE2_MULTILINE;
+			}
+			if (self.ucp) {
+				options |= PCRE2_UCP;
+				options |= PCRE2_UTF;
+				options |= PCRE2_MATCH_INVALID_UTF;
+			}
+			if (self.utf) {
+				options |= PCRE2_UTF;
+			}
+			if (self.literal) {
+				// PCRE2 rejects options that only make sense for patterns
+				// with metacharacters.
+				options &= ~(PCRE2_DOTALL | PCRE2_EXTENDED | PCRE2_MULTILINE | PCRE2_UCP);
+				options |= PCRE2_LITERAL;
+			}
+			return options;
+		}
 	};
 
+	template<typename CharT>
 	struct Match
 	{
-		const wchar_t* subject;
-		//std::wstring_view subject;
+		const CharT* subject;
 		size_t start;
 		size_t end;
 
-		auto as_view(this const Match& self) noexcept -> std::wstring_view
+		auto as_view(this const Match& self) noexcept -> std::basic_string_view<CharT>
 		{
-			return std::wstring_view(self.subject + self.start, self.end - self.start);
+			return std::basic_string_view<CharT>(self.subject + self.start, self.end - self.start);
 		}
 
-		auto suffix(this const Match& self) noexcept -> std::wstring_view
+		auto suffix(this const Match& self) noexcept -> std::basic_string_view<CharT>
 		{
-			return std::wstring_view(self.subject, self.start);
+			return std::basic_string_view<CharT>(self.subject, self.start);
 		}
 
-		auto prefix(this const Match& self) noexcept -> std::wstring_view
+		auto prefix(this const Match& self) noexcept -> std::basic_string_view<CharT>
 		{
-			return std::wstring_view(self.subject + self.end);
+			return std::basic_string_view<CharT>(self.subject + self.end);
 		}
 	};
+
+	/// A match found by a `StreamMatcher`. Offsets count code units from the
+	/// start of the stream. `text` points into the matcher's buffer and is
+	/// only valid until the matcher is used again.
+	template<typename CharT>
+	struct StreamMatch
+	{
+		uint64_t start;
+		uint64_t end;
+		std::basic_string_view<CharT> text;
+	};
+
+	/// A subject whose UTF encoding has already been validated by the caller.
+	///
+	/// When a regex is built with `utf` or `ucp`, PCRE2 validates the subject
+	/// on every search. Searching a `trusted_utf` subject passes
+	/// `PCRE2_NO_UTF_CHECK` from the very first call, so no validation is done
+	/// at all. Passing a subject that is not valid UTF is undefined behavior.
+	template<typename CharT>
+	struct trusted_utf
+	{
+		std::basic_string_view<CharT> subject;
+
+		explicit trusted_utf(std::basic_string_view<CharT> subject) noexcept : subject(subject) {}
+	};
+
+	template<typename CharT>
+	trusted_utf(const CharT*) -> trusted_utf<CharT>;
+
+	template<typename CharT>
+	trusted_utf(std::basic_string_view<CharT>) -> trusted_utf<CharT>;
+
+	template<typename CharT>
+	trusted_utf(const std::basic_string<CharT>&) -> trusted_utf<CharT>;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <optional>
 #include <pcre2.h>
 #include <string>
+#include <system_error>
+#include "traits.h"
 
 namespace pcre2 {
 
@@ -21,6 +23,18 @@ namespace pcre2 {
 		Info,
 		/// An error occurred while setting an option.
 		Option,
+		/// An error occurred while compiling a replacement template.
+		Replacement,
+		/// A search ran into one of the limits in `MatchConfig`, or out of
+		/// JIT stack.
+		Limit,
+		/// A search ran past its deadline.
+		Timeout,
+		/// A search was stopped through its `CancellationToken`.
+		Cancelled,
+		/// The OS failed to open or map a file. The code is an OS error
+		/// code: `errno`, or `GetLastError` on Windows.
+		Io,
 	};
 
 	struct Error
@@ -41,10 +55,45 @@ namespace pcre2 {
 			return Error{ ErrorKind::JIT, code, std::nullopt };
 		}
 
-		/// Create a new matching error.
+		/// Create a new matching error. Running into a resource limit gets
+		/// its own kind, since it says more about the subject than about
+		/// the regex.
 		static auto matching(int code) -> Error
 		{
-			return Error{ ErrorKind::Match, code, std::nullopt };
+			switch (code) {
+			case PCRE2_ERROR_MATCHLIMIT:
+			case PCRE2_ERROR_DEPTHLIMIT:
+			case PCRE2_ERROR_HEAPLIMIT:
+			case PCRE2_ERROR_JIT_STACKLIMIT:
+				return Error{ ErrorKind::Limit, code, std::nullopt };
+			default:
+				return Error{ ErrorKind::Match, code, std::nullopt };
+			}
+		}
+
+		/// Create a new timeout error.
+		static auto timeout() -> Error
+		{
+			return Error{ ErrorKind::Timeout, PCRE2_ERROR_CALLOUT, std::nullopt };
+		}
+
+		/// Create a new cancellation error.
+		static auto cancelled() -> Error
+		{
+			return Error{ ErrorKind::Cancelled, PCRE2_ERROR_CALLOUT, std::nullopt };
+		}
+
+		/// Create the error for a `StreamMatcher` whose match in progress
+		/// outgrew its buffer.
+		static auto stream_limit() -> Error
+		{
+			return Error{ ErrorKind::Limit, PCRE2_ERROR_PARTIAL, std::nullopt };
+		}
+
+		/// Create a new I/O error from an OS error code.
+		static auto io(int code) -> Error
+		{
+			return Error{ ErrorKind::Io, code, std::nullopt };
 		}
 
 		/// Create a new info error.
@@ -59,13 +108,29 @@ namespace pcre2 {
 			return Error{ ErrorKind::Option, code, std::nullopt };
 		}
 
+		/// Create a new replacement template error.
+		static auto replacement(int code, size_t offset) -> Error
+		{
+			return Error{ ErrorKind::Replacement, code, offset };
+		}
+
 		/// Returns the error message from PCRE2.
-		auto error_message(this const Error& self) -> std::wstring
+		template<typename CharT = wchar_t>
+		auto error_message(this const Error& self) -> std::basic_string<CharT>
 		{
+			if (self.kind == ErrorKind::Io) {
+				// PCRE2 knows nothing of OS error codes.
+				auto message = std::system_category().message(self.code);
+				std::basic_string<CharT> out;
+				for (auto c : message) {
+					out.push_back(static_cast<CharT>(static_cast<unsigned char>(c)));
+				}
+				return out;
+			}
 			// PCRE2 docs say a buffer size of 120 bytes is enough, but we're
 			// cautious and double it.
-			std::array<uint16_t, 240> buf{};
-			auto rc = pcre2_get_error_message_16(self.code, buf.data(), buf.size());
+			std::array<CharT, 240> buf{};
+			auto rc = traits<CharT>::error_message(self.code, buf.data(), buf.size());
 			// Errors are only ever constructed from codes reported by PCRE2, so
 			// our code should always be valid.
 			assert(rc != PCRE2_ERROR_BADDATA, "used an invalid error code");
@@ -73,7 +138,7 @@ namespace pcre2 {
 			assert(rc != PCRE2_ERROR_NOMEMORY, "buffer size too small");
 			// Sanity check that we do indeed have a non-negative result. 0 is OK.
 			assert(rc >= 0, "expected non-negative but got {}", rc);
-			return { reinterpret_cast<const wchar_t*>(buf.data()), static_cast<size_t>(rc) };
+			return { buf.data(), static_cast<size_t>(rc) };
 		}
 
 		inline constexpr const wchar_t* description()
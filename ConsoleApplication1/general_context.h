@@ -0,0 +1,67 @@
+﻿#pragma once
+#include <cassert>
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include <pcre2.h>
+#include <memory>
+#include "allocator.h"
+#include "traits.h"
+
+namespace pcre2 {
+
+	/// A PCRE2 general context that allocates through an `Allocator`.
+	///
+	/// PCRE2 copies the memory functions into everything created from the
+	/// context, so the context itself only has to live as long as it is used
+	/// to create things. The allocator has to outlive all of them, though,
+	/// which is why compile contexts and match data share ownership of the
+	/// context and the context shares ownership of the allocator.
+	template<typename CharT>
+	struct GeneralContext
+	{
+		using context_type = typename traits<CharT>::general_context_type;
+
+		context_type* context;
+		std::shared_ptr<Allocator> allocator;
+
+		explicit GeneralContext(std::shared_ptr<Allocator> allocator) : allocator(std::move(allocator))
+		{
+			auto ctx = traits<CharT>::general_context_create(&GeneralContext::allocate, &GeneralContext::deallocate, this->allocator.get());
+			assert(ctx, "could not allocate general context");
+			context = ctx;
+		}
+
+		GeneralContext(const GeneralContext& rhs) = delete;
+
+		~GeneralContext()
+		{
+			traits<CharT>::general_context_free(context);
+		}
+
+		/// A context for `allocator`, or none at all when there is no
+		/// allocator, in which case PCRE2 uses `malloc` and `free`.
+		static auto make_shared(std::shared_ptr<Allocator> allocator) -> std::shared_ptr<GeneralContext>
+		{
+			if (!allocator) {
+				return nullptr;
+			}
+			return std::make_shared<GeneralContext>(std::move(allocator));
+		}
+
+		inline auto as_mut_ptr(this const GeneralContext& self) noexcept -> context_type*
+		{
+			return self.context;
+		}
+
+	private:
+		static void* allocate(size_t size, void* data)
+		{
+			return static_cast<Allocator*>(data)->allocate(size);
+		}
+
+		static void deallocate(void* ptr, void* data)
+		{
+			static_cast<Allocator*>(data)->deallocate(ptr);
+		}
+	};
+}
@@ -0,0 +1,115 @@
+﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <pcre2.h>
+#include "error.h"
+#include "traits.h"
+
+namespace pcre2 {
+
+	/// Lets one thread stop searches running on others.
+	///
+	/// Copies share their state, so a request handler can keep one copy and
+	/// hand another to the searches it starts.
+	class CancellationToken
+	{
+		std::shared_ptr<std::atomic<bool>> cancelled = std::make_shared<std::atomic<bool>>(false);
+
+	public:
+		/// Makes every search using this token stop with
+		/// `ErrorKind::Cancelled` the next time it checks.
+		void cancel(this const CancellationToken& self) noexcept
+		{
+			self.cancelled->store(true, std::memory_order_relaxed);
+		}
+
+		auto is_cancelled(this const CancellationToken& self) noexcept -> bool
+		{
+			return self.cancelled->load(std::memory_order_relaxed);
+		}
+	};
+
+	/// When a search has to give up: at a point in time, once a token is
+	/// cancelled, or both.
+	struct Interrupt
+	{
+		std::optional<std::chrono::steady_clock::time_point> deadline;
+		const CancellationToken* token = nullptr;
+
+		/// The error to stop with, if it is time to stop.
+		auto check(this const Interrupt& self) noexcept -> std::optional<Error>
+		{
+			if (self.token && self.token->is_cancelled()) {
+				return Error::cancelled();
+			}
+			if (self.deadline && std::chrono::steady_clock::now() >= *self.deadline) {
+				return Error::timeout();
+			}
+			return std::nullopt;
+		}
+	};
+
+	namespace inner {
+		/// How many callouts pass between two checks of an `Interrupt`.
+		/// Reading the clock costs more than a callout, so it isn't done at
+		/// every one.
+		inline constexpr uint32_t INTERRUPT_CHECK_INTERVAL = 256;
+	}
+
+	/// Checks an `Interrupt` from the callouts of the searches run with a
+	/// match context, until dropped.
+	///
+	/// PCRE2 only calls out where the pattern asks for it, so a search can
+	/// only be stopped if the code was compiled with `PCRE2_AUTO_CALLOUT`
+	/// (see `RegexOptions::interruptible`) or has callouts of its own.
+	template<typename CharT>
+	class InterruptGuard
+	{
+		using match_context_type = typename traits<CharT>::match_context_type;
+		using callout_block_type = typename traits<CharT>::callout_block_type;
+
+		match_context_type* context;
+		Interrupt interrupt;
+		uint32_t countdown = inner::INTERRUPT_CHECK_INTERVAL;
+		std::optional<Error> stopped;
+
+		static auto on_callout(callout_block_type*, void* data) -> int
+		{
+			auto& self = *static_cast<InterruptGuard*>(data);
+			if (--self.countdown != 0) {
+				return 0;
+			}
+			self.countdown = inner::INTERRUPT_CHECK_INTERVAL;
+			self.stopped = self.interrupt.check();
+			return self.stopped ? PCRE2_ERROR_CALLOUT : 0;
+		}
+
+	public:
+		InterruptGuard(match_context_type* context, Interrupt interrupt) noexcept
+			: context(context), interrupt(interrupt)
+		{
+			traits<CharT>::set_callout(context, &on_callout, this);
+		}
+
+		InterruptGuard(const InterruptGuard&) = delete;
+		InterruptGuard& operator=(const InterruptGuard&) = delete;
+
+		~InterruptGuard()
+		{
+			// Match contexts outlive the search, and may be shared with
+			// other regexes through the scratch arena.
+			traits<CharT>::set_callout(context, nullptr, nullptr);
+		}
+
+		/// Why the search was stopped, if it was.
+		auto error(this const InterruptGuard& self) noexcept -> const std::optional<Error>&
+		{
+			return self.stopped;
+		}
+	};
+}
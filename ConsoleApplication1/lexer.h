@@ -0,0 +1,472 @@
+﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include "code.h"
+#include "compile_context.h"
+#include "config.h"
+#include "error.h"
+#include "match_data.h"
+#include "regex.h"
+#include "regex_builder.h"
+#include "regex_set.h"
+#include "traits.h"
+#include <algorithm>
+#include <cstdint>
+#include <expected>
+#include <initializer_list>
+#include <iterator>
+#include <optional>
+#include <pcre2.h>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pcre2 {
+
+	/// A token found by a `basic_lexer`: the id of the rule that matched, and
+	/// where.
+	struct Token
+	{
+		uint32_t id;
+		size_t start;
+		size_t end;
+	};
+
+	/// Splits subjects into tokens, following an ordered list of rules that
+	/// each pair a token id with a pattern.
+	///
+	/// A token is the match of the first rule that matches where the last
+	/// token ended, however long the matches of the rules after it would
+	/// be, just like the alternation `rule0|rule1|...`. So keywords go
+	/// before the rule for identifiers.
+	///
+	/// The rules are combined into one alternation, compiled anchored, in
+	/// which every branch ends in a `(*MARK)` naming its rule. A token then
+	/// costs one search, whatever the number of rules. Rules that would
+	/// change meaning as a branch (see `basic_regex_set::is_combinable`),
+	/// such as rules with back references, are compiled on their own and
+	/// searched in their turn between the alternations around them.
+	///
+	/// Since rules are anchored, `\G` matches where the token starts, and
+	/// `^` only at the start of the subject. Tokens are never empty.
+	template<typename CharT>
+	class basic_lexer
+	{
+	public:
+		using char_type = CharT;
+		using string_type = std::basic_string<CharT>;
+		using string_view_type = std::basic_string_view<CharT>;
+		using Code = pcre2::Code<CharT>;
+		using CompileContext = pcre2::CompileContext<CharT>;
+		using MatchData = pcre2::MatchData<CharT>;
+		using MatchDataPool = pcre2::MatchDataPool<CharT>;
+		using MatchDataLease = pcre2::MatchDataLease<CharT>;
+		using RegexSet = pcre2::basic_regex_set<CharT>;
+
+	private:
+		/// Rules that are searched together.
+		struct Segment
+		{
+			std::unique_ptr<Code> code;
+			/// The token id of every rule, by the name of its mark. A rule
+			/// compiled on its own has no mark.
+			std::vector<uint32_t> ids;
+		};
+
+		/// The configuration used to build the lexer.
+		Config config;
+		/// The rules, in order.
+		std::vector<Segment> segments;
+		/// Match data that fits every segment. Empty with `shared_scratch`.
+		MatchDataPool match_data;
+		/// The number of offset pairs the segment with the most groups
+		/// needs, group 0 included.
+		uint32_t pairs;
+
+		basic_lexer(Config config, std::vector<Segment> segments, MatchDataPool match_data, uint32_t pairs) noexcept
+			: config(config)
+			, segments(std::move(segments))
+			, match_data(std::move(match_data))
+			, pairs(pairs)
+		{
+		}
+
+		/// Compiles `pattern` anchored. It is anchored at compile time
+		/// rather than with `PCRE2_ANCHORED` at match time, which the JIT
+		/// doesn't support.
+		static auto compile_code(
+			string_view_type pattern,
+			const Config& config,
+			const std::shared_ptr<GeneralContext<CharT>>& general_context
+		) -> std::expected<std::unique_ptr<Code>, Error> {
+			auto ctx = std::make_unique<CompileContext>(general_context);
+			if (config.crlf) {
+				auto rc = ctx->set_newline(PCRE2_NEWLINE_ANYCRLF);
+				if (!rc) return std::unexpected(rc.error());
+			}
+			auto code = Code::make_unique(pattern, config.compile_options() | PCRE2_ANCHORED, std::move(ctx));
+			if (!code) {
+				return code;
+			}
+			switch (config.jit)
+			{
+			case JITChoice::Never:
+				break;
+			case JITChoice::Always:
+				if (auto rc = (*code)->jit_compile(); !rc) {
+					return std::unexpected(rc.error());
+				}
+				break;
+			case JITChoice::Attempt:
+				(void)(*code)->jit_compile();
+				break;
+			}
+			return code;
+		}
+
+		/// Marks are only reported by the backtracking matcher.
+		static auto lexer_match_config(MatchConfig config) noexcept -> MatchConfig
+		{
+			config.engine = MatchEngine::Backtrack;
+			config.dfa_fallback = false;
+			return config;
+		}
+
+		/// Compiles the combinable rules `first` to `last` into alternations,
+		/// as few as PCRE2 accepts, keeping them in order. A rule that
+		/// doesn't compile even alone as a branch is compiled on its own.
+		static auto compile_run(
+			const std::vector<uint32_t>& ids,
+			const std::vector<string_type>& patterns,
+			const std::vector<string_type>& sources,
+			size_t first,
+			size_t last,
+			const Config& config,
+			const Config& combined_config,
+			const std::shared_ptr<GeneralContext<CharT>>& general_context,
+			std::vector<Segment>& segments
+		) -> std::expected<void, Error> {
+			string_type combined;
+			auto append = [&](std::string_view ascii) {
+				combined.append(ascii.begin(), ascii.end());
+				};
+			// Rules may reuse group names.
+			append("(?J)(?:");
+			for (auto i = first; i < last; i++) {
+				if (i != first) {
+					append("|");
+				}
+				append("(?:");
+				combined.append(sources[i]);
+				if (combined_config.extended) {
+					// Ends a trailing comment.
+					append("\n");
+				}
+				append(")(*MARK:");
+				append(std::to_string(i - first));
+				append(")");
+			}
+			append(")");
+
+			if (auto code = compile_code(combined, combined_config, general_context)) {
+				segments.push_back(Segment{ std::move(*code), std::vector<uint32_t>(ids.begin() + first, ids.begin() + last) });
+				return {};
+			}
+			if (last - first == 1) {
+				return compile_code(patterns[first], config, general_context).transform([&](auto code) {
+					segments.push_back(Segment{ std::move(code), { ids[first] } });
+					});
+			}
+			auto half = first + (last - first) / 2;
+			return compile_run(ids, patterns, sources, first, half, config, combined_config, general_context, segments)
+				.and_then([&] {
+					return compile_run(ids, patterns, sources, half, last, config, combined_config, general_context, segments);
+					});
+		}
+
+		/// Borrows match data for a run of searches.
+		auto borrow(this const basic_lexer& self) -> MatchDataLease
+		{
+			if (self.config.match_config.shared_scratch) {
+				auto& arena = ScratchArena<CharT>::local();
+				auto data = arena.acquire(self.pairs, lexer_match_config(self.config.match_config));
+				auto ptr = data.get();
+				return MatchDataLease{ std::nullopt, ScratchLease<CharT>(arena, std::move(data)), ptr };
+			}
+			auto guard = self.match_data.get();
+			auto ptr = &guard.deref_mut();
+			return MatchDataLease{ std::move(guard), {}, ptr };
+		}
+
+	public:
+
+		basic_lexer(basic_lexer&& rhs) noexcept = default;
+
+		basic_lexer(const basic_lexer& rhs) = delete;
+		basic_lexer operator=(const basic_lexer& rhs) = delete;
+
+		static inline auto jit_compile(std::initializer_list<std::pair<uint32_t, string_view_type>> rules) -> std::expected<basic_lexer, Error>
+		{
+			auto options = RegexOptions{};
+			options.jit(true);
+			return jit_compile(rules, options);
+		}
+
+		static inline auto jit_compile(std::initializer_list<std::pair<uint32_t, string_view_type>> rules, RegexOptions& s) -> std::expected<basic_lexer, Error>
+		{
+			return jit_compile<std::initializer_list<std::pair<uint32_t, string_view_type>>>(rules, s);
+		}
+
+		/// Builds a lexer from any range of `(token id, pattern)` pairs. Every
+		/// pattern is compiled with the same options. If any pattern fails to
+		/// compile, its error is returned.
+		template<std::ranges::input_range R>
+			requires std::convertible_to<std::ranges::range_reference_t<R>, std::pair<uint32_t, string_view_type>>
+		static auto jit_compile(const R& rules, RegexOptions& s) -> std::expected<basic_lexer, Error>
+		{
+			Config config = s.config;
+			// PCRE2_LITERAL applies to a whole pattern, so fixed strings are
+			// joined as escaped copies instead.
+			Config combined = config;
+			combined.literal = false;
+			combined.extended = combined.extended && !config.literal;
+			auto general_context = GeneralContext<CharT>::make_shared(config.allocator);
+
+			std::vector<uint32_t> ids;
+			std::vector<string_type> patterns;
+			std::vector<string_type> sources;
+			std::vector<bool> combinable;
+			for (auto&& rule : rules) {
+				std::pair<uint32_t, string_view_type> pair = rule;
+				auto code = Code::make_unique(pair.second, config.compile_options(), std::make_unique<CompileContext>());
+				if (!code) {
+					return std::unexpected(code.error());
+				}
+				auto backrefs = (*code)->backref_max();
+				if (!backrefs) {
+					return std::unexpected(backrefs.error());
+				}
+				ids.push_back(pair.first);
+				patterns.emplace_back(pair.second);
+				sources.push_back(config.literal ? escape(pair.second) : string_type(pair.second));
+				combinable.push_back(*backrefs == 0 && RegexSet::is_combinable(sources.back()));
+			}
+
+			std::vector<Segment> segments;
+			for (size_t i = 0; i < ids.size();) {
+				if (!combinable[i]) {
+					auto code = compile_code(patterns[i], config, general_context);
+					if (!code) {
+						return std::unexpected(code.error());
+					}
+					segments.push_back(Segment{ std::move(*code), { ids[i] } });
+					i += 1;
+					continue;
+				}
+				auto end = i;
+				while (end < ids.size() && combinable[end]) {
+					end += 1;
+				}
+				auto rc = compile_run(ids, patterns, sources, i, end, config, combined, general_context, segments);
+				if (!rc) {
+					return std::unexpected(rc.error());
+				}
+				i = end;
+			}
+
+			uint32_t pairs = 1;
+			for (const auto& segment : segments) {
+				pairs = std::max(pairs, static_cast<uint32_t>(segment.code->capture_count().value_or(1)));
+			}
+			auto match_data = config.match_config.shared_scratch
+				? MatchDataPool()
+				: MatchDataPool::create(
+					[pairs, general_context, config = lexer_match_config(config.match_config)]()
+					{
+						return new MatchData(config, pairs, general_context);
+					},
+					config.match_config.shards);
+			return basic_lexer(config, std::move(segments), std::move(match_data), pairs);
+		}
+
+		/// The tokens of a subject, see `basic_lexer::tokens`.
+		struct Tokens
+		{
+			const basic_lexer& lexer;
+			/// Held for all the tokens of the subject.
+			MatchDataLease match_data;
+			string_view_type subject;
+			/// Where the next token starts.
+			size_t pos;
+			/// Options passed to every search. `PCRE2_NO_UTF_CHECK` is added
+			/// once the first search has validated the subject.
+			uint32_t options;
+
+			struct iterator
+			{
+				using difference_type = std::ptrdiff_t;
+				using element_type = std::expected<Token, Error>;
+				using pointer = element_type*;
+				using reference = const element_type&;
+
+				reference& operator*(this const iterator& self)
+				{
+					if (!self.current)
+					{
+						throw "at the end";
+					}
+					return self.current.value();
+				}
+
+				iterator& operator++()
+				{
+					if (!current)
+					{
+						throw "at the end";
+					}
+
+					if (const auto& v = tokens->next()) {
+						current = *v;
+					}
+					else {
+						current = std::nullopt;
+					}
+
+					++index;
+
+					return *this;
+				}
+
+				void operator++(int) { ++*this; }
+
+				bool operator==(const iterator& iter)
+				{
+					if (!iter.current && !current) return true;
+					return iter.tokens == tokens && iter.index == index;
+				}
+
+				bool operator!=(const iterator& iter)
+				{
+					if (!iter.current && !current) {
+						return false;
+					}
+					return iter.tokens != tokens || iter.index != index;
+				}
+
+				iterator(Tokens* tokens,
+					std::optional<std::expected<Token, Error>>&& start) noexcept : tokens(tokens), index(0)
+				{
+					if (const auto& v = start)
+					{
+						current = *v;
+					}
+				}
+
+				iterator(Tokens* tokens) noexcept : tokens(tokens), index(-1) {}
+
+				iterator(const iterator& iter) noexcept : tokens(iter.tokens), index(iter.index)
+				{
+					if (const auto& v = iter.current)
+					{
+						current = *v;
+					}
+				}
+
+				~iterator() = default;
+
+			private:
+				Tokens* tokens;
+				std::optional<std::expected<Token, Error>> current;
+				int index;
+			};
+
+			static_assert(std::input_iterator<iterator>);
+
+			auto begin() { return iterator(this, next()); };
+
+			auto end() { return iterator(this); };
+
+			/// Returns the next token, or `nullopt` at the end of the subject
+			/// or where no rule matches. `at_end` tells the two apart.
+			auto next(this Tokens& self) -> std::optional<std::expected<Token, Error>>
+			{
+				if (self.pos >= self.subject.size()) {
+					return std::nullopt;
+				}
+				for (const auto& segment : self.lexer.segments) {
+					auto found = self.match_data->find(
+						segment.code.get(),
+						self.subject,
+						self.pos,
+						self.options | PCRE2_NOTEMPTY_ATSTART
+					);
+					if (!found) {
+						return std::unexpected(found.error());
+					}
+					// PCRE2 checks the UTF validity of everything from the
+					// start offset onwards.
+					self.options |= PCRE2_NO_UTF_CHECK;
+					if (!*found) {
+						continue;
+					}
+
+					auto ovector = self.match_data->ovector();
+					auto id = segment.ids.front();
+					if (segment.ids.size() > 1) {
+						auto mark = traits<CharT>::get_mark(self.match_data->as_mut_ptr());
+						assert(mark, "a branch matched without passing its mark");
+						size_t branch = 0;
+						for (auto p = mark; *p != 0; p++) {
+							branch = branch * 10 + static_cast<size_t>(*p - '0');
+						}
+						id = segment.ids[branch];
+					}
+					self.pos = ovector[1];
+					return Token{ id, ovector[0], ovector[1] };
+				}
+				return std::nullopt;
+			}
+
+			/// Whether the tokens so far cover the whole subject.
+			inline auto at_end(this const Tokens& self) noexcept -> bool
+			{
+				return self.pos >= self.subject.size();
+			}
+		};
+
+		/// Returns the tokens of `subject`, from its start up to its end or to
+		/// the first offset no rule matches at. One match data is used for
+		/// all of them.
+		inline auto tokens(this const basic_lexer& self, string_view_type subject) -> Tokens
+		{
+			return Tokens{
+				 .lexer = self,
+				 .match_data = self.borrow(),
+				 .subject = subject,
+				 .pos = 0,
+				 .options = 0,
+			};
+		}
+
+		/// Like `tokens`, but skips UTF validation of the subject.
+		inline auto tokens(this const basic_lexer& self, trusted_utf<CharT> subject) -> Tokens
+		{
+			return Tokens{
+				 .lexer = self,
+				 .match_data = self.borrow(),
+				 .subject = subject.subject,
+				 .pos = 0,
+				 .options = PCRE2_NO_UTF_CHECK,
+			};
+		}
+	};
+
+	using lexer = basic_lexer<char>;
+	using u8lexer = basic_lexer<char8_t>;
+	using wlexer = basic_lexer<wchar_t>;
+	using u16lexer = basic_lexer<char16_t>;
+	using u32lexer = basic_lexer<char32_t>;
+}
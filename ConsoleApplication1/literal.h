@@ -0,0 +1,606 @@
+﻿#pragma once
+#include "config.h"
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define PCRE2_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PCRE2_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PCRE2_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PCRE2_TARGET_AVX2
+#endif
+
+namespace pcre2 {
+
+	/// A pattern that matches a fixed string, searched for without PCRE2.
+	///
+	/// Patterns compiled with `literal(true)`, patterns passed through
+	/// `escape` and patterns that simply contain no metacharacters all match
+	/// one fixed string. Running them through `pcre2_match` costs a call, a
+	/// match data setup and an interpreter (or JIT) entry per search, which
+	/// dominates for short subjects. Instead the needle is searched for
+	/// directly: candidate positions are found by comparing the first and
+	/// last code units of the needle against a whole vector of the subject at
+	/// once, and only those candidates are compared in full.
+	///
+	/// `caseless` is supported for needles whose letters fold the same way in
+	/// ASCII as they do in PCRE2. In UTF mode this excludes `k` and `s`, which
+	/// also match the Kelvin sign and the long s.
+	template<typename CharT>
+	struct Literal
+	{
+		using unit_type = std::conditional_t<sizeof(CharT) == 1, uint8_t,
+			std::conditional_t<sizeof(CharT) == 2, uint16_t, uint32_t>>;
+
+		/// The string to search for, in lower case if `caseless`.
+		std::basic_string<CharT> needle;
+		bool caseless;
+
+		/// Returns the string `pattern` matches if it is a plain literal
+		/// under `config`.
+		static auto parse(
+			std::basic_string_view<CharT> pattern,
+			const Config& config
+		) -> std::optional<Literal> {
+			std::basic_string<CharT> needle;
+			if (config.literal) {
+				needle = pattern;
+			}
+			else {
+				// Whitespace and comments would need interpreting.
+				if (config.extended) {
+					return std::nullopt;
+				}
+				needle.reserve(pattern.size());
+				for (size_t i = 0; i < pattern.size(); i++) {
+					auto c = static_cast<unit_type>(pattern[i]);
+					switch (c)
+					{
+					case '^':
+					case '$':
+					case '.':
+					case '[':
+					case '|':
+					case '(':
+					case ')':
+					case '?':
+					case '*':
+					case '+':
+					case '{':
+						return std::nullopt;
+					case '\\':
+						// Only the escapes `escape` produces, i.e. a backslash
+						// followed by a non-alphanumeric character.
+						if (i + 1 == pattern.size() || is_alnum(static_cast<unit_type>(pattern[i + 1]))) {
+							return std::nullopt;
+						}
+						i += 1;
+						needle.push_back(pattern[i]);
+						break;
+					default:
+						needle.push_back(pattern[i]);
+						break;
+					}
+				}
+			}
+			if (needle.empty()) {
+				return std::nullopt;
+			}
+
+			if (config.caseless) {
+				auto utf = config.utf || config.ucp;
+				for (auto& ch : needle) {
+					auto c = static_cast<unit_type>(ch);
+					if (utf && c >= 0x80) {
+						return std::nullopt;
+					}
+					auto lower = fold(c);
+					if (utf && (lower == 'k' || lower == 's')) {
+						return std::nullopt;
+					}
+					ch = static_cast<CharT>(lower);
+				}
+			}
+			return Literal{ std::move(needle), config.caseless };
+		}
+
+		/// Returns the offset of the first occurrence of the needle in
+		/// `haystack` at or after `start`.
+		auto find(
+			this const Literal& self,
+			std::basic_string_view<CharT> haystack,
+			size_t start
+		) noexcept -> std::optional<size_t> {
+			if (start > haystack.size() || haystack.size() - start < self.needle.size()) {
+				return std::nullopt;
+			}
+			auto hay = reinterpret_cast<const unit_type*>(haystack.data());
+			auto pos = start;
+#if defined(PCRE2_SIMD_X86)
+			// Each kernel leaves `pos` at the first position it didn't check,
+			// which is only ever short of the end for subjects shorter than a
+			// vector.
+			if (has_avx2()) {
+				if (auto at = self.find_avx2(hay, haystack.size(), pos)) {
+					return at;
+				}
+			}
+			if (auto at = self.find_sse2(hay, haystack.size(), pos)) {
+				return at;
+			}
+#endif
+			return self.find_scalar(hay, haystack.size(), pos);
+		}
+
+		/// Whether the needle occurs in `haystack` at offset `at`.
+		auto matches_at(
+			this const Literal& self,
+			std::basic_string_view<CharT> haystack,
+			size_t at
+		) noexcept -> bool {
+			if (at > haystack.size() || haystack.size() - at < self.needle.size()) {
+				return false;
+			}
+			return self.verify(reinterpret_cast<const unit_type*>(haystack.data()) + at);
+		}
+
+	private:
+		static constexpr auto is_alnum(unit_type c) noexcept -> bool
+		{
+			return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		}
+
+		static constexpr auto fold(unit_type c) noexcept -> unit_type
+		{
+			return c >= 'A' && c <= 'Z' ? static_cast<unit_type>(c | 0x20) : c;
+		}
+
+		/// The bits to OR into a code unit before comparing it with `c`. For
+		/// letters this folds ASCII upper case onto lower case. It also maps
+		/// a few non-letters onto letters, which the full comparison weeds out.
+		auto fold_mask(this const Literal& self, unit_type c) noexcept -> unit_type
+		{
+			return self.caseless && c >= 'a' && c <= 'z' ? 0x20 : 0;
+		}
+
+		/// Compares the needle with the start of `hay` in full.
+		auto verify(this const Literal& self, const unit_type* hay) noexcept -> bool
+		{
+			auto needle = reinterpret_cast<const unit_type*>(self.needle.data());
+			if (!self.caseless) {
+				return std::char_traits<CharT>::compare(
+					reinterpret_cast<const CharT*>(hay), self.needle.data(), self.needle.size()) == 0;
+			}
+			for (size_t i = 0; i < self.needle.size(); i++) {
+				if (fold(hay[i]) != needle[i]) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// Searches `hay[pos..len]` one position at a time.
+		auto find_scalar(
+			this const Literal& self,
+			const unit_type* hay,
+			size_t len,
+			size_t pos
+		) noexcept -> std::optional<size_t> {
+			auto n = self.needle.size();
+			auto first = static_cast<unit_type>(self.needle.front());
+			auto first_mask = self.fold_mask(first);
+			for (; pos + n <= len; pos++) {
+				if ((hay[pos] | first_mask) == first && self.verify(hay + pos)) {
+					return pos;
+				}
+			}
+			return std::nullopt;
+		}
+
+#if defined(PCRE2_SIMD_X86)
+		static auto has_avx2() noexcept -> bool
+		{
+			static const bool available = []() {
+#if defined(_MSC_VER)
+				int regs[4] = {};
+				__cpuid(regs, 1);
+				// OSXSAVE and AVX, then whether the OS saves the YMM state.
+				if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0) {
+					return false;
+				}
+				if ((_xgetbv(0) & 6) != 6) {
+					return false;
+				}
+				__cpuidex(regs, 7, 0);
+				return (regs[1] & (1 << 5)) != 0;
+#else
+				return __builtin_cpu_supports("avx2") != 0;
+#endif
+				}();
+			return available;
+		}
+
+		/// Compares every code unit in a vector for equality with `value`,
+		/// returning one bit per byte like `movemask`.
+		static auto cmpeq_sse2(__m128i block, __m128i value) noexcept -> uint32_t
+		{
+			__m128i eq;
+			if constexpr (sizeof(unit_type) == 1) {
+				eq = _mm_cmpeq_epi8(block, value);
+			}
+			else if constexpr (sizeof(unit_type) == 2) {
+				eq = _mm_cmpeq_epi16(block, value);
+			}
+			else {
+				eq = _mm_cmpeq_epi32(block, value);
+			}
+			return static_cast<uint32_t>(_mm_movemask_epi8(eq));
+		}
+
+		static auto set1_sse2(unit_type value) noexcept -> __m128i
+		{
+			if constexpr (sizeof(unit_type) == 1) {
+				return _mm_set1_epi8(static_cast<char>(value));
+			}
+			else if constexpr (sizeof(unit_type) == 2) {
+				return _mm_set1_epi16(static_cast<short>(value));
+			}
+			else {
+				return _mm_set1_epi32(static_cast<int>(value));
+			}
+		}
+
+		/// Checks the candidates in `mask`, which has `sizeof(unit_type)` bits
+		/// per position starting at `hay[pos]`.
+		auto verify_mask(
+			this const Literal& self,
+			const unit_type* hay,
+			size_t pos,
+			uint64_t mask
+		) noexcept -> std::optional<size_t> {
+			constexpr uint64_t lane = (uint64_t(1) << sizeof(unit_type)) - 1;
+			while (mask != 0) {
+				auto bit = static_cast<uint32_t>(std::countr_zero(mask));
+				auto at = pos + bit / sizeof(unit_type);
+				if (self.verify(hay + at)) {
+					return at;
+				}
+				mask &= ~(lane << bit);
+			}
+			return std::nullopt;
+		}
+
+		/// Searches 16 bytes at a time. Leaves `pos` at the first position
+		/// that wasn't checked if the needle wasn't found.
+		///
+		/// The positions left over after the last full vector are covered by
+		/// one more vector that ends at the last position. It overlaps
+		/// positions that were already checked, but none of those matched.
+		auto find_sse2(
+			this const Literal& self,
+			const unit_type* hay,
+			size_t len,
+			size_t& pos
+		) noexcept -> std::optional<size_t> {
+			constexpr size_t step = sizeof(__m128i) / sizeof(unit_type);
+			auto n = self.needle.size();
+			auto first = static_cast<unit_type>(self.needle.front());
+			auto last = static_cast<unit_type>(self.needle.back());
+			auto first_value = set1_sse2(first);
+			auto last_value = set1_sse2(last);
+			auto first_mask = set1_sse2(self.fold_mask(first));
+			auto last_mask = set1_sse2(self.fold_mask(last));
+
+			auto check = [&](size_t at) {
+				auto head = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + at)), first_mask);
+				auto tail = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + at + n - 1)), last_mask);
+				return self.verify_mask(hay, at, cmpeq_sse2(head, first_value) & cmpeq_sse2(tail, last_value));
+				};
+
+			auto end = len - n + 1;
+			auto begin = pos;
+			for (; pos + step <= end; pos += step) {
+				if (auto at = check(pos)) {
+					return at;
+				}
+			}
+			if (pos < end && begin + step <= end) {
+				if (auto at = check(end - step)) {
+					return at;
+				}
+				pos = end;
+			}
+			return std::nullopt;
+		}
+
+		PCRE2_TARGET_AVX2 static auto cmpeq_avx2(__m256i block, __m256i value) noexcept -> __m256i
+		{
+			if constexpr (sizeof(unit_type) == 1) {
+				return _mm256_cmpeq_epi8(block, value);
+			}
+			else if constexpr (sizeof(unit_type) == 2) {
+				return _mm256_cmpeq_epi16(block, value);
+			}
+			else {
+				return _mm256_cmpeq_epi32(block, value);
+			}
+		}
+
+		PCRE2_TARGET_AVX2 static auto load_avx2(const unit_type* p) noexcept -> __m256i
+		{
+			return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		}
+
+		PCRE2_TARGET_AVX2 static auto set1_avx2(unit_type value) noexcept -> __m256i
+		{
+			if constexpr (sizeof(unit_type) == 1) {
+				return _mm256_set1_epi8(static_cast<char>(value));
+			}
+			else if constexpr (sizeof(unit_type) == 2) {
+				return _mm256_set1_epi16(static_cast<short>(value));
+			}
+			else {
+				return _mm256_set1_epi32(static_cast<int>(value));
+			}
+		}
+
+		/// Returns a vector with all bits set in the code units where the first
+		/// and last code units of a needle of length `n` starting there match.
+		PCRE2_TARGET_AVX2 static auto candidates_avx2(
+			const unit_type* hay,
+			size_t n,
+			__m256i first_value,
+			__m256i first_mask,
+			__m256i last_value,
+			__m256i last_mask
+		) noexcept -> __m256i {
+			return _mm256_and_si256(
+				cmpeq_avx2(_mm256_or_si256(load_avx2(hay), first_mask), first_value),
+				cmpeq_avx2(_mm256_or_si256(load_avx2(hay + n - 1), last_mask), last_value));
+		}
+
+		/// Like `find_sse2`, but 32 bytes at a time.
+		PCRE2_TARGET_AVX2 auto find_avx2(
+			this const Literal& self,
+			const unit_type* hay,
+			size_t len,
+			size_t& pos
+		) noexcept -> std::optional<size_t> {
+			constexpr size_t step = sizeof(__m256i) / sizeof(unit_type);
+			auto n = self.needle.size();
+			auto first = static_cast<unit_type>(self.needle.front());
+			auto last = static_cast<unit_type>(self.needle.back());
+
+			auto first_value = set1_avx2(first);
+			auto last_value = set1_avx2(last);
+			auto first_mask = set1_avx2(self.fold_mask(first));
+			auto last_mask = set1_avx2(self.fold_mask(last));
+
+			auto end = len - n + 1;
+			auto begin = pos;
+			// Two vectors per iteration, with a single branch when neither
+			// has a candidate, which is by far the common case.
+			for (; pos + 2 * step <= end; pos += 2 * step) {
+				auto eq0 = candidates_avx2(hay + pos, n, first_value, first_mask, last_value, last_mask);
+				auto eq1 = candidates_avx2(hay + pos + step, n, first_value, first_mask, last_value, last_mask);
+				auto any = _mm256_or_si256(eq0, eq1);
+				if (_mm256_testz_si256(any, any)) {
+					continue;
+				}
+				auto mask = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq0)))
+					| static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq1))) << 32;
+				if (auto at = self.verify_mask(hay, pos, mask)) {
+					return at;
+				}
+			}
+			for (; pos + step <= end; pos += step) {
+				auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(candidates_avx2(hay + pos, n, first_value, first_mask, last_value, last_mask)));
+				if (auto at = self.verify_mask(hay, pos, mask)) {
+					return at;
+				}
+			}
+			if (pos < end && begin + step <= end) {
+				auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(candidates_avx2(hay + end - step, n, first_value, first_mask, last_value, last_mask)));
+				if (auto at = self.verify_mask(hay, end - step, mask)) {
+					return at;
+				}
+				pos = end;
+			}
+			return std::nullopt;
+		}
+#endif
+	};
+
+	/// Finds out which of many literals occur in a subject, in one pass over
+	/// it.
+	///
+	/// Looking for each of N literals with `Literal::find` walks the subject
+	/// N times. A `LiteralSet` instead files every literal under a hash of 2,
+	/// 4 or 8 of its code units (as many as it has), folded to lower case,
+	/// and keeps a rolling hash of that many code units at every position of
+	/// the subject. Only the literals filed under the same hash are compared
+	/// in full, and a literal that was found is not compared again. Every
+	/// literal must be at least two code units long.
+	///
+	/// Literals often share a prefix, like `rule1` and `rule2`, so each one
+	/// is filed under the part of it whose hash the fewest literals use so
+	/// far rather than always under its first code units.
+	template<typename CharT>
+	struct LiteralSet
+	{
+		using unit_type = typename Literal<CharT>::unit_type;
+
+		/// A literal filed under the hash of the code units at `offset`.
+		struct Entry
+		{
+			uint32_t literal;
+			uint32_t offset;
+		};
+
+		/// The literals whose hash covers `width` code units.
+		struct Window
+		{
+			uint32_t width;
+			/// The literals filed under hash `h` are
+			/// `entries[start[h]..start[h + 1]]`.
+			std::vector<uint32_t> start;
+			std::vector<Entry> entries;
+		};
+
+		std::vector<Literal<CharT>> literals;
+		std::vector<Window> windows;
+
+		static constexpr uint32_t hash_bits = 12;
+		static constexpr uint32_t widths[] = { 8, 4, 2 };
+
+		LiteralSet() = default;
+
+		explicit LiteralSet(std::vector<Literal<CharT>> literals)
+			: literals(std::move(literals))
+		{
+			for (auto width : widths) {
+				Window window{ width, std::vector<uint32_t>((static_cast<size_t>(1) << hash_bits) + 1, 0), {} };
+				std::vector<std::pair<uint32_t, Entry>> filed;
+				for (size_t i = 0; i < this->literals.size(); i++) {
+					const auto& needle = this->literals[i].needle;
+					if (window_of(needle.size()) != width) {
+						continue;
+					}
+					// `start[h + 1]` counts the literals filed under `h` so
+					// far. Ties go to the later offset, since suffixes tend
+					// to differ more than prefixes.
+					uint32_t best = 0;
+					uint32_t best_h = bucket(hash(needle.data(), width));
+					for (uint32_t offset = 1; offset + width <= needle.size(); offset++) {
+						auto h = bucket(hash(needle.data() + offset, width));
+						if (window.start[h + 1] <= window.start[best_h + 1]) {
+							best = offset;
+							best_h = h;
+						}
+					}
+					filed.emplace_back(best_h, Entry{ static_cast<uint32_t>(i), best });
+					window.start[best_h + 1] += 1;
+				}
+				if (filed.empty()) {
+					continue;
+				}
+				for (size_t h = 1; h < window.start.size(); h++) {
+					window.start[h] += window.start[h - 1];
+				}
+				window.entries.resize(filed.size());
+				auto next = window.start;
+				for (auto [h, entry] : filed) {
+					window.entries[next[h]++] = entry;
+				}
+				windows.push_back(std::move(window));
+			}
+		}
+
+		inline auto size(this const LiteralSet& self) noexcept -> size_t
+		{
+			return self.literals.size();
+		}
+
+		/// Sets `found[i]` for every literal `i` that occurs in `haystack`,
+		/// and returns how many do.
+		auto scan(
+			this const LiteralSet& self,
+			std::basic_string_view<CharT> haystack,
+			std::vector<bool>& found
+		) -> size_t {
+			found.assign(self.literals.size(), false);
+			auto remaining = self.literals.size();
+			if (remaining == 0) {
+				return 0;
+			}
+
+			// The rolling hash of `haystack[pos..pos + width]` for every
+			// window, and the factor the unit leaving it was multiplied by.
+			uint32_t hashes[std::size(widths)] = {};
+			uint32_t leaving[std::size(widths)] = {};
+			for (size_t w = 0; w < self.windows.size(); w++) {
+				auto width = self.windows[w].width;
+				leaving[w] = 1;
+				for (uint32_t i = 1; i < width; i++) {
+					leaving[w] *= base;
+				}
+				if (haystack.size() >= width) {
+					hashes[w] = hash(haystack.data(), width);
+				}
+			}
+
+			for (size_t pos = 0; pos + 1 < haystack.size(); pos++) {
+				for (size_t w = 0; w < self.windows.size(); w++) {
+					const auto& window = self.windows[w];
+					if (pos + window.width > haystack.size()) {
+						continue;
+					}
+					if (pos != 0) {
+						hashes[w] = (hashes[w] - fold(haystack[pos - 1]) * leaving[w]) * base
+							+ fold(haystack[pos + window.width - 1]);
+					}
+					auto h = bucket(hashes[w]);
+					for (auto k = window.start[h]; k < window.start[h + 1]; k++) {
+						auto [i, offset] = window.entries[k];
+						if (!found[i] && pos >= offset && self.literals[i].matches_at(haystack, pos - offset)) {
+							found[i] = true;
+							remaining -= 1;
+							if (remaining == 0) {
+								return self.literals.size();
+							}
+						}
+					}
+				}
+			}
+			return self.literals.size() - remaining;
+		}
+
+	private:
+		static constexpr uint32_t base = 31;
+
+		/// The widest window that fits a literal of `len` code units.
+		static constexpr auto window_of(size_t len) noexcept -> uint32_t
+		{
+			for (auto width : widths) {
+				if (len >= width) {
+					return width;
+				}
+			}
+			return 0;
+		}
+
+		static constexpr auto fold(CharT c) noexcept -> uint32_t
+		{
+			auto u = static_cast<uint32_t>(static_cast<unit_type>(c));
+			return u >= 'A' && u <= 'Z' ? u | 0x20 : u;
+		}
+
+		static constexpr auto hash(const CharT* units, uint32_t width) noexcept -> uint32_t
+		{
+			uint32_t h = 0;
+			for (uint32_t i = 0; i < width; i++) {
+				h = h * base + fold(units[i]);
+			}
+			return h;
+		}
+
+		static constexpr auto bucket(uint32_t hash) noexcept -> uint32_t
+		{
+			return (hash * 2654435761u) >> (32 - hash_bits);
+		}
+	};
+}
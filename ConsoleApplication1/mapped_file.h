@@ -0,0 +1,221 @@
+﻿#pragma once
+#include "error.h"
+#include <algorithm>
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <string_view>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pcre2 {
+
+	/// A file mapped read-only into memory, so that it can be searched in
+	/// place.
+	///
+	/// The mapping is read from front to back: the kernel is told to read
+	/// ahead, and pages the reader is done with can be handed back with
+	/// `discard_before`. Touching them again is still fine; they are read
+	/// from the file again.
+	class MappedFile
+	{
+		const std::byte* data = nullptr;
+		size_t len = 0;
+		/// Everything before this offset has been discarded.
+		size_t discarded = 0;
+#if defined(_WIN32)
+		HANDLE mapping = nullptr;
+#endif
+
+	public:
+		MappedFile() noexcept = default;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other) noexcept
+			: data(std::exchange(other.data, nullptr))
+			, len(std::exchange(other.len, 0))
+			, discarded(std::exchange(other.discarded, 0))
+#if defined(_WIN32)
+			, mapping(std::exchange(other.mapping, nullptr))
+#endif
+		{
+		}
+
+		MappedFile& operator=(MappedFile&& other) noexcept
+		{
+			if (this != &other) {
+				this->unmap();
+				data = std::exchange(other.data, nullptr);
+				len = std::exchange(other.len, 0);
+				discarded = std::exchange(other.discarded, 0);
+#if defined(_WIN32)
+				mapping = std::exchange(other.mapping, nullptr);
+#endif
+			}
+			return *this;
+		}
+
+		~MappedFile()
+		{
+			this->unmap();
+		}
+
+		/// Maps the file at `path`. Fails with `ErrorKind::Io` and the code
+		/// of the OS error if it can't be opened or mapped. An empty file
+		/// maps to nothing, which is not an error.
+		static auto open(const std::filesystem::path& path) -> std::expected<MappedFile, Error>
+		{
+			MappedFile file;
+#if defined(_WIN32)
+			auto handle = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (handle == INVALID_HANDLE_VALUE) {
+				return std::unexpected(Error::io(static_cast<int>(::GetLastError())));
+			}
+			LARGE_INTEGER size{};
+			if (!::GetFileSizeEx(handle, &size)) {
+				auto code = static_cast<int>(::GetLastError());
+				::CloseHandle(handle);
+				return std::unexpected(Error::io(code));
+			}
+			if (size.QuadPart == 0) {
+				::CloseHandle(handle);
+				return file;
+			}
+			// The view keeps the mapping alive, and the mapping the file.
+			file.mapping = ::CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			auto code = static_cast<int>(::GetLastError());
+			::CloseHandle(handle);
+			if (!file.mapping) {
+				return std::unexpected(Error::io(code));
+			}
+			auto view = ::MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!view) {
+				return std::unexpected(Error::io(static_cast<int>(::GetLastError())));
+			}
+			file.data = static_cast<const std::byte*>(view);
+			file.len = static_cast<size_t>(size.QuadPart);
+#else
+			auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				return std::unexpected(Error::io(errno));
+			}
+			struct stat st{};
+			if (::fstat(fd, &st) != 0) {
+				auto code = errno;
+				::close(fd);
+				return std::unexpected(Error::io(code));
+			}
+			if (st.st_size == 0) {
+				::close(fd);
+				return file;
+			}
+			auto len = static_cast<size_t>(st.st_size);
+			auto ptr = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+			auto code = errno;
+			// The mapping keeps the file open.
+			::close(fd);
+			if (ptr == MAP_FAILED) {
+				return std::unexpected(Error::io(code));
+			}
+			::madvise(ptr, len, MADV_SEQUENTIAL);
+			file.data = static_cast<const std::byte*>(ptr);
+			file.len = len;
+#endif
+			return file;
+		}
+
+		/// The size of the file in bytes.
+		inline auto size(this const MappedFile& self) noexcept -> size_t
+		{
+			return self.len;
+		}
+
+		/// The file as code units of type `CharT`, in the byte order of the
+		/// machine. Bytes that don't make up a whole code unit at the end
+		/// are left out.
+		template<typename CharT>
+		auto units(this const MappedFile& self) noexcept -> std::basic_string_view<CharT>
+		{
+			// PCRE2 doesn't take a null subject, even an empty one.
+			static constexpr CharT EMPTY[1] = {};
+			if (!self.data) {
+				return std::basic_string_view<CharT>(EMPTY, 0);
+			}
+			// Mappings start on a page boundary, so they are aligned for any
+			// code unit.
+			return std::basic_string_view<CharT>(
+				reinterpret_cast<const CharT*>(self.data), self.len / sizeof(CharT));
+		}
+
+		/// Hands back the whole pages before byte `offset`, once there are
+		/// at least `min_bytes` of them that weren't handed back yet. On
+		/// Windows they only leave the working set of the process.
+		void discard_before(this MappedFile& self, size_t offset, size_t min_bytes = 0) noexcept
+		{
+			auto page = page_size();
+			auto end = std::min(offset, self.len) / page * page;
+			if (end <= self.discarded || end - self.discarded < std::max(min_bytes, page)) {
+				return;
+			}
+			auto ptr = const_cast<std::byte*>(self.data) + self.discarded;
+#if defined(_WIN32)
+			// Unlocking pages that aren't locked drops them from the working
+			// set.
+			::VirtualUnlock(ptr, end - self.discarded);
+#else
+			::madvise(ptr, end - self.discarded, MADV_DONTNEED);
+#endif
+			self.discarded = end;
+		}
+
+	private:
+		static auto page_size() noexcept -> size_t
+		{
+			static const size_t size = [] {
+#if defined(_WIN32)
+				SYSTEM_INFO info{};
+				::GetSystemInfo(&info);
+				return static_cast<size_t>(info.dwPageSize);
+#else
+				return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+			}();
+			return size;
+		}
+
+		void unmap(this MappedFile& self) noexcept
+		{
+#if defined(_WIN32)
+			if (self.data) {
+				::UnmapViewOfFile(self.data);
+			}
+			if (self.mapping) {
+				::CloseHandle(self.mapping);
+			}
+			self.mapping = nullptr;
+#else
+			if (self.data) {
+				::munmap(const_cast<std::byte*>(self.data), self.len);
+			}
+#endif
+			self.data = nullptr;
+			self.len = 0;
+			self.discarded = 0;
+		}
+	};
+}
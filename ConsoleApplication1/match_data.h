@@ -2,87 +2,176 @@
 
 #define PCRE2_STATIC
 #define PCRE2_CODE_UNIT_WIDTH 0
+#include "code.h"
+#include "compile_context.h"
 #include "config.h"
 #include "error.h"
+#include "general_context.h"
+#include "traits.h"
+#include <algorithm>
 #include <expected>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <pcre2.h>
 #include <span>
+#include <vector>
 
 namespace pcre2 {
 
+	template<typename CharT>
 	struct MatchData
 	{
+		using match_context_type = typename traits<CharT>::match_context_type;
+		using match_data_type = typename traits<CharT>::match_data_type;
+		using jit_stack_type = typename traits<CharT>::jit_stack_type;
+
 		MatchConfig config;
-		pcre2_match_context_16* match_context;
-		pcre2_match_data_16* match_data;
-		std::optional<pcre2_jit_stack_16*> jit_stack;
+		/// Where everything below gets its memory, if not from `malloc`.
+		std::shared_ptr<GeneralContext<CharT>> general_context;
+		match_context_type* match_context;
+		match_data_type* match_data;
+		std::optional<jit_stack_type*> jit_stack;
+		/// Workspace for the DFA matcher, kept between searches like the
+		/// match data itself. Empty until the DFA matcher is first used.
+		mutable std::vector<int> dfa_workspace;
 		const size_t* ovector_ptr;
 		uint32_t ovector_count;
 
 		MatchData(const MatchData&) = delete;
 		MatchData operator=(const MatchData&) = delete;
 
-		MatchData(MatchConfig config, const Code* code) : config(config)
+		/// Creates match data for `code`, allocating from the same allocator
+		/// as the code.
+		MatchData(MatchConfig config, const Code<CharT>* code)
+			: config(config), general_context(code->ctx->general_context)
 		{
-			match_context = pcre2_match_context_create_16(nullptr);
+			auto gctx = CompileContext<CharT>::general_context_ptr(general_context);
+			match_context = traits<CharT>::match_context_create(gctx);
 			assert(match_context, "failed to allocate match context");
 
-			match_data = pcre2_match_data_create_from_pattern_16(
-				code->as_ptr(),
-				nullptr);
+			match_data = traits<CharT>::match_data_create_from_pattern(code->as_ptr(), gctx);
 			assert(match_data, "failed to allocate match data block");
 
-			jit_stack = [&]() -> std::optional<pcre2_jit_stack_16*> {
+			jit_stack = [&]() -> std::optional<jit_stack_type*> {
 				if (!code->compiled_jit) {
 					return std::nullopt;
 				}
 				if (const auto& max = config.max_jit_stack_size) {
-					auto stack = pcre2_jit_stack_create_16(
+					auto stack = traits<CharT>::jit_stack_create(
 						std::min<size_t>(*max, static_cast<size_t>(32 * 1) << 10),
 						*max,
-						nullptr
+						gctx
 					);
-					assert(!stack, "failed to allocate JIT stack");
+					assert(stack, "failed to allocate JIT stack");
 
-					pcre2_jit_stack_assign_16(
-						match_context,
-						nullptr,
-						stack
-					);
+					traits<CharT>::jit_stack_assign(match_context, stack);
 					return stack;
 				}
 
 				return std::nullopt;
 				}();
 
-			ovector_ptr = pcre2_get_ovector_pointer_16(match_data);
+			ovector_ptr = traits<CharT>::ovector_pointer(match_data);
+			assert(ovector_ptr, "got NULL ovector pointer");
+			ovector_count = traits<CharT>::ovector_count(match_data);
+			this->configure(config);
+		}
+
+		/// Creates match data for `ScratchArena`, which serves every regex on
+		/// the thread. Nothing ties it to an allocator, so it uses `malloc`.
+		/// See the constructor taking a general context.
+		MatchData(MatchConfig config, uint32_t pairs) : MatchData(config, pairs, nullptr)
+		{
+		}
+
+		/// Creates match data that isn't tied to one pattern, allocating from
+		/// `general_context`, or with `malloc` if it is null. It has room for
+		/// `pairs` offset pairs (group 0 included), so it works with any code
+		/// that has at most `pairs - 1` capture groups. The JIT stack is
+		/// created whenever `config` asks for one, since it isn't known yet
+		/// which code will use it.
+		MatchData(
+			MatchConfig config,
+			uint32_t pairs,
+			std::shared_ptr<GeneralContext<CharT>> general_context
+		) : config(config), general_context(std::move(general_context))
+		{
+			auto gctx = CompileContext<CharT>::general_context_ptr(this->general_context);
+			match_context = traits<CharT>::match_context_create(gctx);
+			assert(match_context, "failed to allocate match context");
+
+			match_data = traits<CharT>::match_data_create(pairs, gctx);
+			assert(match_data, "failed to allocate match data block");
+
+			if (const auto& max = config.max_jit_stack_size) {
+				auto stack = traits<CharT>::jit_stack_create(
+					std::min<size_t>(*max, static_cast<size_t>(32 * 1) << 10),
+					*max,
+					gctx
+				);
+				assert(stack, "failed to allocate JIT stack");
+
+				traits<CharT>::jit_stack_assign(match_context, stack);
+				jit_stack = stack;
+			}
+
+			ovector_ptr = traits<CharT>::ovector_pointer(match_data);
 			assert(ovector_ptr, "got NULL ovector pointer");
-			ovector_count = pcre2_get_ovector_count_16(match_data);
+			ovector_count = traits<CharT>::ovector_count(match_data);
+			this->configure(config);
 		}
 
 		~MatchData()
 		{
 			if (auto& stack = jit_stack)
 			{
-				pcre2_jit_stack_free_16(*stack);
+				traits<CharT>::jit_stack_free(*stack);
 			}
-			pcre2_match_data_free_16(match_data);
-			pcre2_match_context_free_16(match_context);
+			traits<CharT>::match_data_free(match_data);
+			traits<CharT>::match_context_free(match_context);
 		}
 
 		auto find(
 			this const MatchData& self,
-			const Code* code,
-			std::wstring_view subject,
+			const Code<CharT>* code,
+			std::basic_string_view<CharT> subject,
 			size_t start,
 			uint32_t options
 		) -> std::expected<bool, Error> {
+			if (self.config.engine == MatchEngine::Dfa) {
+				return self.find_dfa(code, subject, start, options);
+			}
+
+			auto found = self.find_backtracking(code, subject, start, options);
+			if (!found && found.error().kind == ErrorKind::Limit && self.config.dfa_fallback) {
+				// The DFA matcher doesn't backtrack, so the match limit
+				// would only cut it short on long subjects.
+				traits<CharT>::set_match_limit(self.match_context, std::numeric_limits<uint32_t>::max());
+				auto retried = self.find_dfa(code, subject, start, options);
+				traits<CharT>::set_match_limit(self.match_context,
+					self.config.match_limit.value_or(default_limit(PCRE2_CONFIG_MATCHLIMIT)));
+				if (retried) {
+					return *retried;
+				}
+			}
+			return found;
+		}
 
-			auto rc = pcre2_match_16(
+		/// Runs a search with the backtracking matcher whatever the engine
+		/// is, and returns `ErrorKind::Limit` instead of falling back to the
+		/// DFA matcher. Searches whose capture groups are read afterwards go
+		/// through here, since the DFA matcher leaves them unset.
+		auto find_backtracking(
+			this const MatchData& self,
+			const Code<CharT>* code,
+			std::basic_string_view<CharT> subject,
+			size_t start,
+			uint32_t options
+		) -> std::expected<bool, Error> {
+			auto rc = traits<CharT>::execute(
 				code->as_ptr(),
-				std::bit_cast<PCRE2_SPTR16>(subject.data()),
-				subject.size(),
+				subject,
 				start,
 				options,
 				self.as_mut_ptr(),
@@ -100,12 +189,83 @@ namespace pcre2 {
 			}
 		}
 
-		inline auto as_mut_ptr(this const MatchData& self) noexcept -> pcre2_match_data_16*
+		/// Runs a search with PCRE2's DFA matcher, which tracks every way
+		/// the pattern can match at once instead of backtracking, so its run
+		/// time doesn't blow up. It picks the longest match at the leftmost
+		/// position, which need not be the one a backtracking search picks,
+		/// or the shortest one with `PCRE2_DFA_SHORTEST`. It doesn't report
+		/// groups, so every group after the first is left unset.
+		///
+		/// Patterns with backreferences, backtracking verbs and a few other
+		/// items fail with `PCRE2_ERROR_DFA_UITEM` and friends.
+		auto find_dfa(
+			this const MatchData& self,
+			const Code<CharT>* code,
+			std::basic_string_view<CharT> subject,
+			size_t start,
+			uint32_t options
+		) -> std::expected<bool, Error> {
+			if (self.dfa_workspace.empty()) {
+				self.dfa_workspace.resize(DFA_WORKSPACE_LEN);
+			}
+			auto rc = 0;
+			while (true) {
+				rc = traits<CharT>::dfa_execute(
+					code->as_ptr(),
+					subject,
+					start,
+					options,
+					self.as_mut_ptr(),
+					self.match_context,
+					self.dfa_workspace.data(),
+					self.dfa_workspace.size()
+				);
+				// The workspace stays with the match data, so this only
+				// happens until it is big enough for the patterns using it.
+				if (rc != PCRE2_ERROR_DFA_WSSIZE || self.dfa_workspace.size() >= DFA_WORKSPACE_MAX_LEN) {
+					break;
+				}
+				self.dfa_workspace.resize(self.dfa_workspace.size() * 2);
+			}
+
+			if (rc == PCRE2_ERROR_NOMATCH) {
+				return false;
+			}
+			if (rc < 0) {
+				return std::unexpected(Error::matching(rc));
+			}
+			// The other pairs hold shorter matches at the same position.
+			auto ovector = const_cast<size_t*>(self.ovector_ptr);
+			for (size_t i = 2; i < static_cast<size_t>(self.capacity()) * 2; i++) {
+				ovector[i] = PCRE2_UNSET;
+			}
+			return true;
+		}
+
+		/// Applies the engine and limits in `config` to this match data.
+		/// Limits that aren't set go back to PCRE2's defaults, so match data
+		/// can move between regexes with different settings.
+		void configure(this MatchData& self, const MatchConfig& config)
+		{
+			self.config.engine = config.engine;
+			self.config.match_limit = config.match_limit;
+			self.config.depth_limit = config.depth_limit;
+			self.config.heap_limit = config.heap_limit;
+			self.config.dfa_fallback = config.dfa_fallback;
+			traits<CharT>::set_match_limit(self.match_context,
+				config.match_limit.value_or(default_limit(PCRE2_CONFIG_MATCHLIMIT)));
+			traits<CharT>::set_depth_limit(self.match_context,
+				config.depth_limit.value_or(default_limit(PCRE2_CONFIG_DEPTHLIMIT)));
+			traits<CharT>::set_heap_limit(self.match_context,
+				config.heap_limit.value_or(default_limit(PCRE2_CONFIG_HEAPLIMIT)));
+		}
+
+		inline auto as_mut_ptr(this const MatchData& self) noexcept -> match_data_type*
 		{
 			return self.match_data;
 		}
 
-		explicit operator pcre2_match_data_16* (this const MatchData& self) noexcept
+		explicit operator match_data_type* (this const MatchData& self) noexcept
 		{
 			return self.match_data;
 		}
@@ -114,5 +274,35 @@ namespace pcre2 {
 		{
 			return std::span<const size_t>(self.ovector_ptr, self.ovector_count * 2);
 		}
+
+		/// The number of offset pairs PCRE2 can write, which may be more than
+		/// `ovector` reports.
+		inline auto capacity(this const MatchData& self) noexcept -> uint32_t
+		{
+			return traits<CharT>::ovector_count(self.match_data);
+		}
+
+		/// Limits `ovector` to its first `pairs` pairs. Match data shared
+		/// between patterns is sized for the largest of them, but each
+		/// search should only report the groups of its own pattern.
+		inline void set_ovector_len(this MatchData& self, uint32_t pairs) noexcept
+		{
+			self.ovector_count = std::min(pairs, self.capacity());
+		}
+
+	private:
+		/// The number of ints the DFA matcher starts out with to keep track
+		/// of where it is. PCRE2 suggests 1000 for most patterns.
+		static constexpr size_t DFA_WORKSPACE_LEN = 1000;
+		/// How far the workspace may grow for patterns that need more.
+		static constexpr size_t DFA_WORKSPACE_MAX_LEN = static_cast<size_t>(1) << 18;
+
+		/// The limit PCRE2 was built with.
+		static auto default_limit(uint32_t what) noexcept -> uint32_t
+		{
+			uint32_t value = 0;
+			traits<CharT>::config(what, &value);
+			return value;
+		}
 	};
 }
\ No newline at end of file
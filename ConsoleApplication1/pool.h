@@ -30,8 +30,10 @@ being quite expensive.
 /// is possible because a pool is guaranteed to provide a value to exactly one
 /// thread at any time.
 ///
-/// Currently, a pool never contracts in size. Its size is proportional to the
-/// maximum number of simultaneous uses. This may change in the future.
+/// A pool's size is proportional to the maximum number of simultaneous uses,
+/// up to a fixed bound per stack beyond which returned values are freed.
+/// Values that sit unused for a while are freed again (see
+/// `POOL_DECAY_INTERVAL`), and `Pool::trim` frees all of them on demand.
 ///
 /// A `Pool` is a particularly useful data structure for this crate because
 /// PCRE2 requires a mutable "cache" in order to execute a search. Since
@@ -51,13 +53,34 @@ being quite expensive.
 /// perhaps the worst choices. Of the remaining two choices, whether you use
 /// this `Pool` or thread through a cache explicitly in your code is a matter
 /// of taste and depends on your code architecture.
+#include <array>
 #include <atomic>
-#include <vector>
-#include <optional>
-#include <memory>
-#include <mutex>
+#include <bit>
+#include <chrono>
+#include <cstdint>
 #include <expected>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+/// How a thread that doesn't own a pool picks the stack it takes values
+/// from and returns them to.
+enum class ShardPolicy
+{
+	/// By thread ID. Works everywhere, but threads that take turns on one
+	/// core can still land on different stacks.
+	Thread,
+	/// By the CPU the thread is running on, with one stack per online CPU,
+	/// so a value tends to stay in the cache of the core that uses it. Only
+	/// supported on Linux. Elsewhere this behaves like `Thread`.
+	Cpu,
+};
 
 namespace inner
 {
@@ -65,18 +88,18 @@ namespace inner
 	///
 	/// We specifically start our counter at 3 so that we can use the values
 	/// less than it as sentinels.
-	static std::atomic<size_t> COUNTER = std::atomic<size_t>(3);
+	inline std::atomic<size_t> COUNTER = std::atomic<size_t>(3);
 
 	/// A thread ID indicating that there is no owner. This is the initial
 	/// state of a pool. Once a pool has an owner, there is no way to change
 	/// it.
-	static size_t THREAD_ID_UNOWNED = 0;
+	inline constexpr size_t THREAD_ID_UNOWNED = 0;
 
 	/// A thread ID indicating that the special owner value is in use and not
 	/// available. This state is useful for avoiding a case where the owner
 	/// of a pool calls `get` before putting the result of a previous `get`
 	/// call back into the pool.
-	static constexpr size_t THREAD_ID_INUSE = 1;
+	inline constexpr size_t THREAD_ID_INUSE = 1;
 
 	/// This sentinel is used to indicate that a guard has already been dropped
 	/// and should not be re-dropped. We use this because our drop code can be
@@ -88,7 +111,7 @@ namespace inner
 	/// So this isn't strictly necessary, but this let's us define some
 	/// routines as safe (like PoolGuard::put_imp) that we couldn't otherwise
 	/// do.
-	static constexpr size_t THREAD_ID_DROPPED = 2;
+	inline constexpr size_t THREAD_ID_DROPPED = 2;
 
 	/// The number of stacks we use inside of the pool. These are only used for
 	/// non-owners. That is, these represent the "slow" path.
@@ -120,37 +143,71 @@ namespace inner
 	/// Keeping it at 8 limits, to an extent, how much unnecessary memory can
 	/// be allocated.
 	///
-	/// In an ideal world, we'd be able to have something like this:
+	/// This is only the upper bound. A pool starts out using a single stack
+	/// and doubles the number in use whenever threads keep colliding on one
+	/// (see `POOL_GROW_CONTENTION`), so a regex that is only ever searched
+	/// from a couple of threads doesn't spread its values over 8 stacks.
 	///
-	/// * Grow the number of stacks as the number of concurrent callers
-	/// increases. I spent a little time trying this, but even just adding an
-	/// atomic addition/subtraction for each pop/push for tracking concurrent
-	/// callers led to a big perf hit. Since even more work would seemingly be
-	/// required than just an addition/subtraction, I abandoned this approach.
-	/// * The maximum amount of memory used should scale with respect to the
-	/// number of concurrent callers and *not* the total number of existing
-	/// threads. This is primarily why the `thread_local` crate isn't used, as
-	/// as some environments spin up a lot of threads. This led to multiple
-	/// reports of extremely high memory usage (often described as memory
-	/// leaks).
-	/// * Even more ideally, the pool should contract in size. That is, it
-	/// should grow with bursts and then shrink. But this is a pretty thorny
-	/// issue to tackle and it might be better to just not.
-	/// * It would be nice to explore the use of, say, a lock-free stack
-	/// instead of using a mutex to guard a `Vec` that is ultimately just
-	/// treated as a stack. The main thing preventing me from exploring this
-	/// is the ABA problem. The `crossbeam` crate has tools for dealing with
-	/// this sort of problem (via its epoch based memory reclamation strategy),
-	/// but I can't justify bringing in all of `crossbeam` as a dependency of
-	/// `regex` for this.
-	///
-	/// See this issue for more context and discussion:
+	/// Each stack used to be a mutex guarding a vector. They are now bounded
+	/// lock-free queues (see `Stack`), which sidesteps the ABA problem that
+	/// makes a lock-free linked stack awkward: slots are never freed and each
+	/// one carries a sequence number. See this issue for more context and
+	/// discussion:
 	/// https://github.com/rust-lang/regex/issues/934
-	static const constexpr size_t MAX_POOL_STACKS = 8;
+	inline constexpr size_t MAX_POOL_STACKS = 8;
+
+	/// The number of values each stack can hold. A value put back into a
+	/// full stack is freed instead, so a pool never keeps more than
+	/// `MAX_POOL_STACKS * MAX_POOL_STACK_LEN` values plus the owner's value.
+	/// Must be a power of two.
+	inline constexpr size_t MAX_POOL_STACK_LEN = 16;
+
+	/// The number of failed CAS operations or pushes into a full stack
+	/// after which a pool doubles the number of stacks it uses.
+	inline constexpr uint32_t POOL_GROW_CONTENTION = 64;
+
+	/// How often a stack frees values that went unused. Every interval, half
+	/// of the values that stayed in the stack the whole time are freed.
+	///
+	/// There is no background thread, so this happens on a later put into
+	/// the same stack. A pool that sees no traffic at all keeps its values
+	/// until `Pool::trim` is called.
+	inline constexpr auto POOL_DECAY_INTERVAL = std::chrono::seconds(1);
+
+	/// A thread only checks whether a decay is due on every this many puts,
+	/// to keep clock reads off the hot path. Must be a power of two.
+	inline constexpr uint32_t POOL_DECAY_CHECK = 64;
+
+	/// The number of stacks to use for `ShardPolicy::Cpu`, or zero if it
+	/// isn't supported.
+	inline auto cpu_stack_count() noexcept -> size_t
+	{
+#if defined(__linux__)
+		static const size_t count = [] {
+			auto n = ::sysconf(_SC_NPROCESSORS_ONLN);
+			return n > 0 ? static_cast<size_t>(n) : 0;
+			}();
+		return count;
+#else
+		return 0;
+#endif
+	}
+
+	/// The CPU the calling thread is running on, or `fallback` if that
+	/// can't be determined. glibc 2.35 and later answer this from the rseq
+	/// area the kernel keeps up to date, so it doesn't make a system call.
+	inline auto current_cpu([[maybe_unused]] size_t fallback) noexcept -> size_t
+	{
+#if defined(__linux__)
+		if (auto cpu = ::sched_getcpu(); cpu >= 0) {
+			return static_cast<size_t>(cpu);
+		}
+#endif
+		return fallback;
+	}
 
-	//thread_local!(
-		/// A thread local used to assign an ID to a thread.
-	thread_local size_t THREAD_ID = [] {
+	/// A thread local used to assign an ID to a thread.
+	inline thread_local size_t THREAD_ID = [] {
 		auto next = COUNTER.fetch_add(1, std::memory_order::relaxed);
 		// SAFETY: We cannot permit the reuse of thread IDs since reusing a
 		// thread ID might result in more than one thread "owning" a pool,
@@ -165,90 +222,167 @@ namespace inner
 		// This checks that the counter never wraps around, since atomic
 		// addition wraps around on overflow.
 		if (next == 0) {
-			throw std::exception("regex: thread ID allocation space exhausted");
+			throw std::runtime_error("regex: thread ID allocation space exhausted");
 		}
 		return next;
 		}();
-	//);
-
-		/// This puts each stack in the pool below into its own cache line. This is
-		/// an absolutely critical optimization that tends to have the most impact
-		/// in high contention workloads. Without forcing each mutex protected
-		/// into its own cache line, high contention exacerbates the performance
-		/// problem by causing "false sharing." By putting each mutex in its own
-		/// cache-line, we avoid the false sharing problem and the affects of
-		/// contention are greatly reduced.
 
+	/// This puts each stack in the pool below into its own cache line. This is
+	/// an absolutely critical optimization that tends to have the most impact
+	/// in high contention workloads. Without forcing each stack into its own
+	/// cache line, high contention exacerbates the performance problem by
+	/// causing "false sharing." By putting each stack in its own cache-line,
+	/// we avoid the false sharing problem and the affects of contention are
+	/// greatly reduced.
+	///
+	/// The stacks are stored by value in one array, so this aligns the stack
+	/// itself and not just a pointer to it.
 	template<typename T>
-	struct __declspec(align(64)) CacheLine
+	struct alignas(64) CacheLine
 	{
 		T value;
 	};
 
-	template<typename T, typename M = std::mutex>
-	class Mutex
+	/// A bounded lock-free queue of owned `T` values.
+	///
+	/// This is Dmitry Vyukov's bounded MPMC queue. Every slot carries a
+	/// sequence number that says whether it is ready to be written or read
+	/// for the current lap, so pushing and popping are a single CAS on the
+	/// tail or head counter and nothing is ever allocated or freed. It isn't
+	/// LIFO like the mutex-guarded vector it replaced, but all values in a
+	/// stack are interchangeable so that doesn't matter.
+	template<typename T, size_t N>
+	class Stack
 	{
-	public:
+		static_assert(N > 0 && (N & (N - 1)) == 0, "the capacity must be a power of two");
 
-		Mutex() : contents(new T()), m(new M()) {}
+		struct Slot
+		{
+			std::atomic<size_t> sequence;
+			T* value;
+		};
 
-		Mutex(const Mutex& other) = delete;
-		Mutex operator=(const Mutex& other) = delete;
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+		std::array<Slot, N> slots;
 
-		Mutex(Mutex&& other) : contents(other.contents), m(other.m)
+	public:
+		/// The number of CAS operations that lost a race, plus the number of
+		/// values turned away because the stack was full, since the pool last
+		/// looked at it.
+		std::atomic<uint32_t> contention;
+		/// The fewest values this stack held since the last decay. That many
+		/// values weren't needed by anyone during the interval.
+		std::atomic<size_t> low_water;
+		/// When the next decay is due, in `steady_clock` ticks. Zero until
+		/// the first check.
+		std::atomic<std::chrono::steady_clock::rep> decay_at;
+
+		Stack() noexcept : head(0), tail(0), contention(0), low_water(N), decay_at(0)
 		{
-			other.contents = nullptr;
-			other.m = nullptr;
+			for (size_t i = 0; i < N; i++) {
+				slots[i].sequence.store(i, std::memory_order::relaxed);
+				slots[i].value = nullptr;
+			}
 		}
 
-		Mutex operator=(Mutex&& other)
+		Stack(const Stack&) = delete;
+		Stack& operator=(const Stack&) = delete;
+
+		~Stack()
 		{
-			return std::move(other);
+			while (auto value = pop()) {
+				delete value;
+			}
 		}
 
-		//template <typename... Args>
-		//Mutex(Args&&... args) : contents(new T(std::forward<Args>(args)...)), m(new M()) {}
-		~Mutex()
+		/// Takes ownership of `value`, unless the stack is full, in which
+		/// case `value` is handed back.
+		auto push(std::unique_ptr<T> value) noexcept -> std::unique_ptr<T>
 		{
-			delete m;
-			delete contents;
+			auto pos = tail.load(std::memory_order::relaxed);
+			while (true) {
+				auto& slot = slots[pos & (N - 1)];
+				auto seq = slot.sequence.load(std::memory_order::acquire);
+				auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order::relaxed)) {
+						slot.value = value.release();
+						slot.sequence.store(pos + 1, std::memory_order::release);
+						return nullptr;
+					}
+					contention.fetch_add(1, std::memory_order::relaxed);
+				}
+				else if (diff < 0) {
+					// A full stack means more values are in use at once than
+					// one stack can hold, which is a reason to spread out
+					// just like a lost race is.
+					contention.fetch_add(1, std::memory_order::relaxed);
+					return value;
+				}
+				else {
+					pos = tail.load(std::memory_order::relaxed);
+				}
+			}
 		}
 
-		struct Locker
+		/// Removes a value, or returns null if the stack is empty.
+		auto pop() noexcept -> T*
 		{
-			T* operator->() { return contents; }
-			std::unique_lock<M> lock;
-			T* contents;
-		};
-
-		Locker Acquire() { return { std::unique_lock(*m), contents }; }
+			auto pos = head.load(std::memory_order::relaxed);
+			while (true) {
+				auto& slot = slots[pos & (N - 1)];
+				auto seq = slot.sequence.load(std::memory_order::acquire);
+				auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order::relaxed)) {
+						auto value = slot.value;
+						slot.sequence.store(pos + N, std::memory_order::release);
+						if (auto left = len(); left < low_water.load(std::memory_order::relaxed)) {
+							low_water.store(left, std::memory_order::relaxed);
+						}
+						return value;
+					}
+					contention.fetch_add(1, std::memory_order::relaxed);
+				}
+				else if (diff < 0) {
+					return nullptr;
+				}
+				else {
+					pos = head.load(std::memory_order::relaxed);
+				}
+			}
+		}
 
-		bool try_lock() const
+		/// The number of values in the stack. This is only a snapshot when
+		/// other threads are pushing or popping.
+		auto len() const noexcept -> size_t
 		{
-			return m->try_lock();
+			auto t = tail.load(std::memory_order::relaxed);
+			auto h = head.load(std::memory_order::relaxed);
+			return t > h ? std::min(t - h, N) : 0;
 		}
 
-		void unlock() const
+		/// Frees up to `n` values.
+		void discard(size_t n) noexcept
 		{
-			m->unlock();
+			for (size_t i = 0; i < n; i++) {
+				auto value = pop();
+				if (!value) {
+					break;
+				}
+				delete value;
+			}
 		}
-
-		Locker operator->() { return Acquire(); }
-		//T Copy() { return Acquire().contents; }
-		T* Ref() { return contents; }
-
-	private:
-		T* contents;
-		M* m;
 	};
 
 	/// A thread safe pool utilizing std-only features.
 	///
 	/// The main difference between this and the simplistic alloc-only pool is
-	/// the use of std::sync::Mutex and an "owner thread" optimization that
+	/// the use of lock-free stacks and an "owner thread" optimization that
 	/// makes accesses by the owner of a pool faster than all other threads.
 	/// This makes the common case of running a regex within a single thread
-	/// faster by avoiding mutex unlocking.
+	/// faster by avoiding any atomic read-modify-write.
 	template<typename T, typename F>
 	struct Pool {
 		/// A function to create more T values when stack is empty and a caller
@@ -257,10 +391,22 @@ namespace inner
 		/// Multiple stacks of T values to hand out. These are used when a Pool
 		/// is accessed by a thread that didn't create it.
 		///
-		/// Conceptually this is `Mutex<Vec<Box<T>>>`, but sharded out to make
-		/// it scale better under high contention work-loads. We index into
-		/// this sequence via `thread_id % stacks.len()`.
-		std::vector<CacheLine<Mutex<std::vector<std::unique_ptr<T>>>>> stacks;
+		/// Conceptually this is `Vec<Box<T>>`, but sharded out to make it
+		/// scale better under high contention work-loads. We index into this
+		/// sequence via `thread_id % stack_count`, or `cpu % stack_count`
+		/// with `ShardPolicy::Cpu`.
+		std::unique_ptr<CacheLine<Stack<T, MAX_POOL_STACK_LEN>>[]> stacks;
+		/// The length of `stacks`. This is `MAX_POOL_STACKS`, or the number
+		/// of CPUs with `ShardPolicy::Cpu`.
+		size_t max_stacks;
+		/// How many of `stacks` are in use. With `ShardPolicy::Thread` this
+		/// is always a power of two that grows with contention. Values left
+		/// in stacks past this (after a `trim`) are never handed out, so
+		/// shrinking it is only done while emptying every stack. With
+		/// `ShardPolicy::Cpu` every stack is in use from the start.
+		std::atomic<size_t> stack_count;
+		/// Whether stacks are picked by CPU rather than by thread.
+		bool per_cpu;
 		/// The ID of the thread that owns this pool. The owner is the thread
 		/// that makes the first call to 'get'. When the owner calls 'get', it
 		/// gets 'owner_val' directly instead of returning a T from 'stack'.
@@ -269,13 +415,13 @@ namespace inner
 		///
 		/// It is initialized to a value of zero (an impossible thread ID) as a
 		/// sentinel to indicate that it is unowned.
-		std::atomic<size_t> owner;
+		alignas(64) std::atomic<size_t> owner;
 		/// A value to return when the caller is in the same thread that
 		/// first called `Pool::get`.
 		///
 		/// This is set to None when a Pool is first created, and set to Some
 		/// once the first thread calls Pool::get.
-		std::optional<std::unique_ptr<T>> owner_val;// : UnsafeCell<Option<T>>,
+		std::optional<std::unique_ptr<T>> owner_val;
 
 		struct PoolGuard
 		{
@@ -286,149 +432,79 @@ namespace inner
 			/// in the special case of `Err(THREAD_ID_DROPPED)`, it means the
 			/// guard has been put back into the pool and should no longer be used.
 			std::expected<std::unique_ptr<T>, size_t> v;
-			/// When true, the value should be discarded instead of being pushed
-			/// back into the pool. We tend to use this under high contention, and
-			/// this allows us to avoid inflating the size of the pool. (Because
-			/// under contention, we tend to create more values instead of waiting
-			/// for access to a stack of existing values.)
-			bool discard;
 
-			auto value(this const PoolGuard& self) -> const T&
+			PoolGuard(Pool<T, F>& pool, std::expected<std::unique_ptr<T>, size_t> v) noexcept
+				: pool(pool), v(std::move(v))
 			{
-				if (self.v)
-				{
-					return *self.v->get();
-				}
+			}
 
-				auto id = self.v.error();
-
-				return self.pool.owner_val.value();
-
-				//match self.value{
-				//	Ok(ref v) = > &**v,
-				//	// SAFETY: This is safe because the only way a PoolGuard gets
-				//	// created for self.value=Err is when the current thread
-				//	// corresponds to the owning thread, of which there can only
-				//	// be one. Thus, we are guaranteed to be providing exclusive
-				//	// access here which makes this safe.
-				//	//
-				//	// Also, since 'owner_val' is guaranteed to be initialized
-				//	// before an owned PoolGuard is created, the unchecked unwrap
-				//	// is safe.
-				//	Err(id) = > unsafe {
-				//		// This assert is *not* necessary for safety, since we
-				//		// should never be here if the guard had been put back into
-				//		// the pool. This is a sanity check to make sure we didn't
-				//		// break an internal invariant.
-				//		debug_assert_ne!(THREAD_ID_DROPPED, id);
-				//		(*self.pool.owner_val.get()).as_ref().unwrap_unchecked()
-				//	},
-				//}
+			/// A moved-from guard no longer owns anything, so dropping it
+			/// must not hand the value back to the pool.
+			PoolGuard(PoolGuard&& other) noexcept
+				: pool(other.pool)
+				, v(std::exchange(other.v, std::unexpected(THREAD_ID_DROPPED)))
+			{
+			}
+
+			PoolGuard(const PoolGuard&) = delete;
+			PoolGuard& operator=(const PoolGuard&) = delete;
+
+			auto value(this const PoolGuard& self) -> const T&
+			{
+				return self.value_mut();
 			}
 
 			auto value_mut(this const PoolGuard& self) -> T&
 			{
 				if (self.v)
 				{
-					return *self.v->get();
+					return **self.v;
 				}
 
-				auto id = self.v.error();
-
-				return *self.pool.owner_val.value();
-
-				//match self.value{
-				//	Ok(ref mut v) = > &mut * *v,
-				//	// SAFETY: This is safe because the only way a PoolGuard gets
-				//	// created for self.value=None is when the current thread
-				//	// corresponds to the owning thread, of which there can only
-				//	// be one. Thus, we are guaranteed to be providing exclusive
-				//	// access here which makes this safe.
-				//	//
-				//	// Also, since 'owner_val' is guaranteed to be initialized
-				//	// before an owned PoolGuard is created, the unwrap_unchecked
-				//	// is safe.
-				//	Err(id) = > unsafe {
-				//		// This assert is *not* necessary for safety, since we
-				//		// should never be here if the guard had been put back into
-				//		// the pool. This is a sanity check to make sure we didn't
-				//		// break an internal invariant.
-				//		debug_assert_ne!(THREAD_ID_DROPPED, id);
-				//		(*self.pool.owner_val.get()).as_mut().unwrap_unchecked()
-				//	},
-				//}
+				// SAFETY: This is safe because the only way a PoolGuard gets
+				// created for self.value=Err is when the current thread
+				// corresponds to the owning thread, of which there can only
+				// be one. Thus, we are guaranteed to be providing exclusive
+				// access here which makes this safe.
+				//
+				// Also, since 'owner_val' is guaranteed to be initialized
+				// before an owned PoolGuard is created, the dereference
+				// is safe.
+				assert(THREAD_ID_DROPPED != self.v.error());
+				return **self.pool.owner_val;
 			}
 
 			static void put(PoolGuard& value)
 			{
-				// Since this is effectively consuming the guard and putting the
-				// value back into the pool, there's no reason to run its Drop
-				// impl after doing this. I don't believe there is a correctness
-				// problem with doing so, but there's definitely a perf problem
-				// by redoing this work. So we avoid it.
-				//auto v = core::mem::ManuallyDrop::new(value);
 				value.put_imp();
 			}
 
 			inline void put_imp(this PoolGuard& self)
 			{
-				if (auto& v = self.v)
+				if (self.v)
 				{
-					if (self.discard)
-					{
-						return;
-					}
-					self.pool.put_value(std::move(*v));
+					auto value = std::move(*self.v);
 					self.v = std::unexpected(THREAD_ID_DROPPED);
+					self.pool.put_value(std::move(value));
+					return;
 				}
-				else {
-					auto owner = self.v.error();
-					assert(THREAD_ID_DROPPED != owner);
-					self.pool.owner.store(owner, std::memory_order::release);
-				}
-
-				/*if (auto value = std::exchange(self.v, std::unexpected(THREAD_ID_DROPPED))) {
-					if (self.discard)
-					{
-						return;
-					}
-					self.pool.put_value(std::move(*value));
+				// If this guard has a value "owned" by the thread, then
+				// the Pool guarantees that this is the ONLY such guard.
+				// Therefore, in order to place it back into the pool and make
+				// it available, we need to change the owner back to the owning
+				// thread's ID. But note that we use the ID that was stored in
+				// the guard, since a guard can be moved to another thread and
+				// dropped.
+				//
+				// An explicit `put` is followed by the destructor, so a guard
+				// that was already put back is left alone. Storing the owner a
+				// second time could hand out the owner's value twice.
+				auto owner = self.v.error();
+				if (owner == THREAD_ID_DROPPED) {
+					return;
 				}
-				else {
-					auto owner = value.error();
-					assert(THREAD_ID_DROPPED != owner);
-					self.pool.owner.store(owner, std::memory_order::release);
-				}*/
-
-				//match core::mem::replace(&self.v, Err(THREAD_ID_DROPPED)) {
-				//	Ok(value) = > {
-				//		// If we were told to discard this value then don't bother
-				//		// trying to put it back into the pool. This occurs when
-				//		// the pop operation failed to acquire a lock and we
-				//		// decided to create a new value in lieu of contending for
-				//		// the lock.
-				//		if self.discard{
-				//			return;
-				//		}
-				//		self.pool.put_value(value);
-				//	}
-				//	// If this guard has a value "owned" by the thread, then
-				//	// the Pool guarantees that this is the ONLY such guard.
-				//	// Therefore, in order to place it back into the pool and make
-				//	// it available, we need to change the owner back to the owning
-				//	// thread's ID. But note that we use the ID that was stored in
-				//	// the guard, since a guard can be moved to another thread and
-				//	// dropped. (A previous iteration of this code read from the
-				//	// THREAD_ID thread local, which uses the ID of the current
-				//	// thread which may not be the ID of the owning thread! This
-				//	// also avoids the TLS access, which is likely a hair faster.)
-				//	Err(owner) = > {
-				//		// If we hit this point, it implies 'put_imp' has been
-				//		// called multiple times for the same guard which in turn
-				//		// corresponds to a bug in this implementation.
-				//		assert_ne!(THREAD_ID_DROPPED, owner);
-				//		self.pool.owner.store(owner, std::memory_order::release);
-				//	}
+				self.v = std::unexpected(THREAD_ID_DROPPED);
+				self.pool.owner.store(owner, std::memory_order::release);
 			}
 
 			~PoolGuard()
@@ -437,41 +513,25 @@ namespace inner
 			}
 		};
 
-		Pool(F create) : owner(THREAD_ID_UNOWNED), create(create)
+		Pool(F create, ShardPolicy policy = ShardPolicy::Thread)
+			: create(create)
+			, max_stacks(MAX_POOL_STACKS)
+			, stack_count(1)
+			, per_cpu(false)
+			, owner(THREAD_ID_UNOWNED)
 		{
-			// MSRV(1.63): Mark this function as 'const'. I've arranged the
-			// code such that it should "just work." Then mark the public
-			// 'Pool::new' method as 'const' too. (The alloc-only Pool::new
-			// is already 'const', so that should "just work" too.) The only
-			// thing we're waiting for is Mutex::new to be const.
-
-			stacks.reserve(MAX_POOL_STACKS);
-
-			for (size_t i = 0; i < stacks.capacity(); i++)
-			{
-				stacks.emplace_back(Mutex<std::vector<std::unique_ptr<T>>>());
+			if (policy == ShardPolicy::Cpu) {
+				if (auto cpus = cpu_stack_count(); cpus > 0) {
+					max_stacks = cpus;
+					stack_count.store(cpus, std::memory_order::relaxed);
+					per_cpu = true;
+				}
 			}
+			stacks = std::make_unique<CacheLine<Stack<T, MAX_POOL_STACK_LEN>>[]>(max_stacks);
 		}
 
-		//static auto new1(F create) -> Pool<T, F>
-		//{
-		//	// MSRV(1.63): Mark this function as 'const'. I've arranged the
-		//	// code such that it should "just work." Then mark the public
-		//	// 'Pool::new' method as 'const' too. (The alloc-only Pool::new
-		//	// is already 'const', so that should "just work" too.) The only
-		//	// thing we're waiting for is Mutex::new to be const.
-		//	std::vector<CacheLine<Mutex<std::vector<std::unique_ptr<T>>>>> stacks;
-		//	stacks.reserve(MAX_POOL_STACKS);
-
-		//	for (size_t i = 0; i < stacks.capacity(); i++)
-		//	{
-		//		stacks.push_back(CacheLine(Mutex(std::vector<std::unique_ptr<T>>())));
-		//	}
-
-		//	auto owner = std::atomic<size_t>(THREAD_ID_UNOWNED);
-		//	auto owner_val = std::nullopt;// UnsafeCell::new(None); // init'd on first access
-		//	return Pool{ create, stacks, THREAD_ID_UNOWNED, /*owner,*/ owner_val };
-		//}
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
 
 		auto get(this Pool& self) -> PoolGuard
 		{
@@ -488,7 +548,7 @@ namespace inner
 			// racy load and a store. We know that if 'owner == caller', then
 			// only one thread can be here, so we don't need to worry about any
 			// other thread setting the owner to something else.
-			auto caller = THREAD_ID;// .with(| id | *id);
+			auto caller = THREAD_ID;
 			auto owner = self.owner.load(std::memory_order::acquire);
 			if (caller == owner) {
 				// N.B. We could also do a CAS here instead of a load/store,
@@ -515,8 +575,9 @@ namespace inner
 				// indicates that the owned value is in use. The owner ID will
 				// get updated to the actual ID of this thread once the guard
 				// returned by this function is put back into the pool.
+				auto expected = THREAD_ID_UNOWNED;
 				auto res = self.owner.compare_exchange_strong(
-					THREAD_ID_UNOWNED,
+					expected,
 					THREAD_ID_INUSE,
 					std::memory_order::acq_rel,
 					std::memory_order::acquire
@@ -524,107 +585,166 @@ namespace inner
 				if (res) {
 					// SAFETY: A successful CAS above implies this thread is
 					// the owner and that this is the only such thread that
-					// can reach here. Thus, there is no data race.
-
-					self.owner_val = std::move(std::unique_ptr<T>(self.create()));// std::invoke(self.create); self.create();
+					// can reach here. Thus, there is no data race. The value
+					// may already exist if `prewarm` created it.
+					if (!self.owner_val) {
+						self.owner_val = std::unique_ptr<T>(self.create());
+					}
 					return self.guard_owned(caller);
 				}
 			}
-			auto stack_id = caller % self.stacks.size();
-			// We try to acquire exclusive access to this thread's stack, and
-			// if so, grab a value from it if we can. We put this in a loop so
-			// that it's easy to tweak and experiment with a different number
-			// of tries. In the end, I couldn't see anything obviously better
-			// than one attempt in ad hoc testing.
-
-			for (int i = 0; i < 10; i++)
-			{
-				auto& stack = self.stacks[stack_id].value;
-				/*	{
-						Err(_) = > continue,
-							Ok(stack) = > stack,
-					};*/
-				if (stack.try_lock()) {
-					if (auto v = stack.Ref(); !v->empty()) {
-						std::unique_ptr s(std::move(v->back()));
-						v->pop_back();
-						stack.unlock();
-						return self.guard_stack(std::move(s));
-					}
-				}
+			// Popping never blocks, so unlike with the old mutex-guarded
+			// stacks there is no need to give up and create a value that is
+			// thrown away afterwards. An empty stack means every value is in
+			// use, which is the only time a new one is created.
+			auto& stack = self.stack_for(caller);
+			auto value = stack.pop();
+			self.grow_if_contended(stack);
+			if (value) {
+				return self.guard_stack(std::unique_ptr<T>(value));
+			}
+			return self.guard_stack(std::unique_ptr<T>(self.create()));
+		}
 
-				// Unlock the mutex guarding the stack before creating a fresh
-				// value since we no longer need the stack.
-				stack.unlock();
-				auto value = std::unique_ptr<T>
-					(
-						self.create()
-						//(self.create)()
-					);
-				return self.guard_stack(std::move(value));
+		/// The stack the given thread pushes to and pops from.
+		auto stack_for(this Pool& self, size_t caller) noexcept -> Stack<T, MAX_POOL_STACK_LEN>&
+		{
+			auto count = self.stack_count.load(std::memory_order::relaxed);
+			auto key = self.per_cpu ? current_cpu(caller) : caller;
+			return self.stacks[key % count].value;
+		}
+
+		/// Doubles the number of stacks in use once threads have collided
+		/// on `stack` often enough.
+		void grow_if_contended(this Pool& self, Stack<T, MAX_POOL_STACK_LEN>& stack) noexcept
+		{
+			if (self.per_cpu
+				|| stack.contention.load(std::memory_order::relaxed) < POOL_GROW_CONTENTION) {
+				return;
+			}
+			stack.contention.store(0, std::memory_order::relaxed);
+			auto count = self.stack_count.load(std::memory_order::relaxed);
+			if (count < MAX_POOL_STACKS) {
+				self.stack_count.compare_exchange_strong(count, count * 2, std::memory_order::relaxed);
+			}
+		}
+
+		/// Frees half of the values that went unused in `stack` during the
+		/// last `POOL_DECAY_INTERVAL`, if that interval is over.
+		void decay(this Pool& self, Stack<T, MAX_POOL_STACK_LEN>& stack) noexcept
+		{
+			using clock = std::chrono::steady_clock;
+			auto now = clock::now().time_since_epoch().count();
+			auto next = now + std::chrono::duration_cast<clock::duration>(POOL_DECAY_INTERVAL).count();
+			auto at = stack.decay_at.load(std::memory_order::relaxed);
+			if (at != 0 && now < at) {
+				return;
+			}
+			// Only one thread gets to decay a stack per interval.
+			if (!stack.decay_at.compare_exchange_strong(at, next, std::memory_order::relaxed)) {
+				return;
+			}
+			auto unused = std::min(stack.low_water.exchange(stack.len(), std::memory_order::relaxed), stack.len());
+			// The first check only starts the clock, since nothing was
+			// tracked before it.
+			if (at != 0) {
+				stack.discard((unused + 1) / 2);
 			}
-			// We're only here if we could get access to our stack, so just
-			// create a new value. This seems like it could be wasteful, but
-			// waiting for exclusive access to a stack when there's high
-			// contention is brutal for perf.
-			return self.guard_stack_transient(std::unique_ptr<T>(
-				self.create()
-				//(self.create)()
-			));
 		}
 
 		/// Puts a value back into the pool. Callers don't need to call this.
 		/// Once the guard that's returned by 'get' is dropped, it is put back
 		/// into the pool automatically.
-
+		///
+		/// If this thread's stack is full the value is freed, which keeps a
+		/// burst of concurrent searches from growing the pool without bound.
 		void put_value(this Pool& self, std::unique_ptr<T> value) {
-			auto caller = THREAD_ID;// .with(| id | *id);
-			auto stack_id = caller % self.stacks.size();
-			// As with trying to pop a value from this thread's stack, we
-			// merely attempt to get access to push this value back on the
-			// stack. If there's too much contention, we just give up and throw
-			// the value away.
-			//
-			// Interestingly, in ad hoc benchmarking, it is beneficial to
-			// attempt to push the value back more than once, unlike when
-			// popping the value. I don't have a good theory for why this is.
-			// I guess if we drop too many values then that winds up forcing
-			// the pop operation to create new fresh values and thus leads to
-			// less reuse. There's definitely a balancing act here.
-			for (int i = 0; i < 10; i++)
-			{
-				auto& s = self.stacks[stack_id];
-				auto& stack = s.value;
-				if (stack.try_lock())
-				{
-					stack.Ref()->emplace_back(std::move(value));
-					stack.unlock();
-					return;
+			thread_local uint32_t puts = 0;
+			auto caller = THREAD_ID;
+			auto& stack = self.stack_for(caller);
+			stack.push(std::move(value));
+			self.grow_if_contended(stack);
+			if ((++puts & (POOL_DECAY_CHECK - 1)) == 0) {
+				self.decay(stack);
+			}
+		}
+
+		/// Creates `n` values ahead of time, so that the first `n`
+		/// simultaneous calls to `get` don't have to. Uses as many stacks as
+		/// it takes to hold them, and stops early once those are full.
+		void prewarm(this Pool& self, size_t n)
+		{
+			if (n == 0) {
+				return;
+			}
+			// The first thread to call `get` takes the owner's value, so
+			// create that one too. Holding the INUSE sentinel keeps any
+			// other thread from claiming the pool meanwhile.
+			auto expected = THREAD_ID_UNOWNED;
+			if (self.owner.compare_exchange_strong(
+				expected,
+				THREAD_ID_INUSE,
+				std::memory_order::acq_rel,
+				std::memory_order::acquire)) {
+				if (!self.owner_val) {
+					self.owner_val = std::unique_ptr<T>(self.create());
+				}
+				self.owner.store(THREAD_ID_UNOWNED, std::memory_order::release);
+				n -= 1;
+			}
+
+			auto count = self.stack_count.load(std::memory_order::relaxed);
+			if (!self.per_cpu) {
+				auto wanted = std::bit_ceil(std::min(
+					(n + MAX_POOL_STACK_LEN - 1) / MAX_POOL_STACK_LEN,
+					MAX_POOL_STACKS
+				));
+				while (count < wanted
+					&& !self.stack_count.compare_exchange_weak(count, wanted, std::memory_order::relaxed)) {
+				}
+				count = std::max(count, wanted);
+			}
+
+			for (size_t i = 0; i < n; i++) {
+				auto& stack = self.stacks[i % count].value;
+				if (stack.len() >= MAX_POOL_STACK_LEN) {
+					break;
+				}
+				if (stack.push(std::unique_ptr<T>(self.create()))) {
+					break;
 				}
 			}
 		}
 
-		/// Create a guard that represents the special owned T.
+		/// Frees every value that isn't currently handed out, except the
+		/// owner's. With `ShardPolicy::Thread` this also goes back to using
+		/// a single stack.
+		///
+		/// The owner's value stays: the owner thread takes it without any
+		/// read-modify-write, so there is no way to take it away safely.
+		void trim(this Pool& self) noexcept
+		{
+			if (!self.per_cpu) {
+				self.stack_count.store(1, std::memory_order::relaxed);
+			}
+			for (size_t i = 0; i < self.max_stacks; i++) {
+				auto& stack = self.stacks[i].value;
+				stack.discard(MAX_POOL_STACK_LEN);
+				stack.contention.store(0, std::memory_order::relaxed);
+				stack.low_water.store(0, std::memory_order::relaxed);
+			}
+		}
 
+		/// Create a guard that represents the special owned T.
 		auto guard_owned(this Pool& self, size_t caller) -> PoolGuard
 		{
-			return PoolGuard{ .pool = self, .v = std::unexpected(caller), .discard = false };
+			return PoolGuard(self, std::unexpected(caller));
 		}
 
 		/// Create a guard that contains a value from the pool's stack.
-
 		auto guard_stack(this Pool& self, std::unique_ptr<T> value) -> PoolGuard
 		{
-			return PoolGuard{ .pool = self, .v = std::move(value), .discard = false };
-		}
-
-		/// Create a guard that contains a value from the pool's stack with an
-		/// instruction to throw away the value instead of putting it back
-		/// into the pool.
-
-		auto guard_stack_transient(this Pool& self, std::unique_ptr<T> value) -> PoolGuard
-		{
-			return PoolGuard{ .pool = self, .v = std::move(value), .discard = true };
+			return PoolGuard(self, std::move(value));
 		}
 	};
 }
@@ -673,9 +793,9 @@ struct Pool
 		}
 	};
 
-	static auto create(F create) -> Pool<T, F>
+	static auto create(F create, ShardPolicy policy = ShardPolicy::Thread) -> Pool<T, F>
 	{
-		return Pool(std::move(std::make_unique<inner::Pool<T, F>>(create)));
+		return Pool(std::move(std::make_unique<inner::Pool<T, F>>(create, policy)));
 	}
 
 	auto get(this const Pool& self) -> PoolGuard
@@ -683,6 +803,16 @@ struct Pool
 		return PoolGuard(self.pool->get());
 	}
 
+	void prewarm(this const Pool& self, size_t n)
+	{
+		self.pool->prewarm(n);
+	}
+
+	void trim(this const Pool& self) noexcept
+	{
+		self.pool->trim();
+	}
+
 	auto operator() (this const Pool& self) -> PoolGuard {
 		return PoolGuard(self.pool->get());
 	}
@@ -0,0 +1,634 @@
+﻿#pragma once
+#include "config.h"
+#include "literal.h"
+#include "traits.h"
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace pcre2 {
+
+	/// Literal strings that every match of a pattern must contain, used to
+	/// reject subjects before PCRE2 ever sees them.
+	///
+	/// PCRE2 itself only knows about a single first and last code unit
+	/// (`PCRE2_INFO_FIRSTCODEUNIT` and `PCRE2_INFO_LASTCODEUNIT`). This pass
+	/// reads the pattern and works out whole strings instead:
+	///
+	/// * `prefix`, which every match starts with. No match can start before
+	/// its first occurrence, so the search can start there.
+	/// * `required`, the longest string every match contains. If it doesn't
+	/// occur after the start offset, there is no match.
+	///
+	/// Both are searched for with `Literal`. The analysis only needs to be
+	/// sound, not complete: anything it doesn't understand, like an inline
+	/// `(?i)`, `\G` or recursion, makes it give up rather than guess.
+	template<typename CharT>
+	struct Prefilter
+	{
+		std::optional<Literal<CharT>> prefix;
+		std::optional<Literal<CharT>> required;
+
+		/// Analyzes a pattern that has already compiled successfully with
+		/// `config`. Returns `nullopt` if nothing useful was found.
+		static auto analyze(
+			std::basic_string_view<CharT> pattern,
+			const Config& config
+		) -> std::optional<Prefilter> {
+			if (config.literal || config.extended) {
+				return std::nullopt;
+			}
+			Parser parser{ pattern, config, 0, false };
+			auto info = parser.alternation();
+			if (parser.failed || parser.pos != pattern.size()) {
+				return std::nullopt;
+			}
+
+			// A single code unit is no better than what PCRE2 does already.
+			constexpr size_t min_len = 2;
+			Prefilter result;
+			if (info.prefix.size() >= min_len) {
+				result.prefix = Literal<CharT>{ info.prefix, config.caseless };
+			}
+			if (info.required.size() >= min_len && info.required != info.prefix) {
+				result.required = Literal<CharT>{ info.required, config.caseless };
+			}
+			if (!result.prefix && !result.required) {
+				return std::nullopt;
+			}
+			return result;
+		}
+
+		/// Returns the offset a search starting at `start` should hand to
+		/// PCRE2, or `nullopt` if `subject` can't match.
+		auto start_at(
+			this const Prefilter& self,
+			std::basic_string_view<CharT> subject,
+			size_t start
+		) noexcept -> std::optional<size_t> {
+			if (self.prefix) {
+				auto at = self.prefix->find(subject, start);
+				if (!at) {
+					return std::nullopt;
+				}
+				start = *at;
+			}
+			if (self.required && !self.required->find(subject, start)) {
+				return std::nullopt;
+			}
+			return start;
+		}
+
+	private:
+		using string_type = std::basic_string<CharT>;
+		using unit_type = typename Literal<CharT>::unit_type;
+
+		/// What is known about the strings a piece of a pattern matches.
+		struct Info
+		{
+			/// The piece always matches exactly `prefix`, which then equals
+			/// `suffix` and `required`.
+			bool exact;
+			string_type prefix;
+			string_type suffix;
+			string_type required;
+
+			static auto literal(string_type s) -> Info
+			{
+				return Info{ true, s, s, s };
+			}
+
+			/// Matches the empty string, like an assertion.
+			static auto empty() -> Info
+			{
+				return Info{ true, {}, {}, {} };
+			}
+
+			/// Could match anything.
+			static auto unknown() -> Info
+			{
+				return Info{ false, {}, {}, {} };
+			}
+
+			static auto longest(const string_type& a, const string_type& b) -> const string_type&
+			{
+				return b.size() > a.size() ? b : a;
+			}
+
+			static auto concat(const Info& a, const Info& b) -> Info
+			{
+				if (a.exact && b.exact) {
+					return literal(a.prefix + b.prefix);
+				}
+				auto joined = a.suffix + b.prefix;
+				return Info{
+					false,
+					a.exact ? a.prefix + b.prefix : a.prefix,
+					b.exact ? a.suffix + b.suffix : b.suffix,
+					longest(longest(a.required, b.required), joined)
+				};
+			}
+
+			static auto alternate(const Info& a, const Info& b) -> Info
+			{
+				if (a.exact && b.exact && a.prefix == b.prefix) {
+					return a;
+				}
+				auto p = std::mismatch(a.prefix.begin(), a.prefix.end(), b.prefix.begin(), b.prefix.end());
+				auto s = std::mismatch(a.suffix.rbegin(), a.suffix.rend(), b.suffix.rbegin(), b.suffix.rend());
+				auto prefix = string_type(a.prefix.begin(), p.first);
+				auto suffix = string_type(s.first.base(), a.suffix.end());
+				auto required = longest(prefix, suffix);
+				return Info{ false, std::move(prefix), std::move(suffix), required };
+			}
+
+			static auto repeat(const Info& a, size_t min, size_t max) -> Info
+			{
+				if (min == 0) {
+					return unknown();
+				}
+				if (min == 1 && max == 1) {
+					return a;
+				}
+				return Info{ false, a.prefix, a.suffix, a.required };
+			}
+		};
+
+		/// A recursive descent parser over just enough of the PCRE2 syntax
+		/// to find the literal parts of a pattern.
+		struct Parser
+		{
+			std::basic_string_view<CharT> pattern;
+			const Config& config;
+			size_t pos;
+			bool failed;
+
+			static constexpr size_t unbounded = static_cast<size_t>(-1);
+
+			auto at_end(this const Parser& self) noexcept -> bool
+			{
+				return self.pos >= self.pattern.size();
+			}
+
+			auto peek(this const Parser& self, size_t offset = 0) noexcept -> unit_type
+			{
+				auto at = self.pos + offset;
+				return at < self.pattern.size() ? static_cast<unit_type>(self.pattern[at]) : 0;
+			}
+
+			auto fail(this Parser& self) -> Info
+			{
+				self.failed = true;
+				self.pos = self.pattern.size();
+				return Info::unknown();
+			}
+
+			static constexpr auto is_digit(unit_type c) noexcept -> bool
+			{
+				return c >= '0' && c <= '9';
+			}
+
+			static constexpr auto is_alpha(unit_type c) noexcept -> bool
+			{
+				return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+			}
+
+			auto is_utf(this const Parser& self) noexcept -> bool
+			{
+				return self.config.utf || self.config.ucp;
+			}
+
+			/// The literal character `pattern[start..pos]`, taking caseless
+			/// matching into account.
+			auto character(this const Parser& self, size_t start) -> Info
+			{
+				auto chars = string_type(self.pattern.substr(start, self.pos - start));
+				if (!self.config.caseless) {
+					return Info::literal(std::move(chars));
+				}
+				auto c = static_cast<unit_type>(chars[0]);
+				// Same rules as `Literal::parse`.
+				if (self.is_utf() && (c >= 0x80 || c == 'k' || c == 'K' || c == 's' || c == 'S')) {
+					return Info::unknown();
+				}
+				if (c >= 'A' && c <= 'Z') {
+					chars[0] = static_cast<CharT>(c | 0x20);
+				}
+				return Info::literal(std::move(chars));
+			}
+
+			/// Consumes one character, which is several code units for
+			/// non-ASCII characters in UTF-8 and UTF-16.
+			auto advance_char(this Parser& self) noexcept -> void
+			{
+				if (self.is_utf()) {
+					self.pos = traits<CharT>::next_char(self.pattern, self.pos);
+				}
+				else {
+					self.pos += 1;
+				}
+			}
+
+			auto alternation(this Parser& self) -> Info
+			{
+				auto info = self.sequence();
+				while (!self.failed && self.peek() == '|' && !self.at_end()) {
+					self.pos += 1;
+					info = Info::alternate(info, self.sequence());
+				}
+				return info;
+			}
+
+			auto sequence(this Parser& self) -> Info
+			{
+				auto info = Info::empty();
+				while (!self.failed && !self.at_end() && self.peek() != '|' && self.peek() != ')') {
+					auto atom = self.atom();
+					while (!self.failed && self.quantifier(atom)) {
+					}
+					info = Info::concat(info, atom);
+				}
+				return info;
+			}
+
+			auto atom(this Parser& self) -> Info
+			{
+				auto start = self.pos;
+				switch (self.peek())
+				{
+				case '\\':
+					return self.escape();
+				case '[':
+					return self.skip_class();
+				case '(':
+					return self.group();
+				case '.':
+					self.pos += 1;
+					return Info::unknown();
+				case '^':
+				case '$':
+					self.pos += 1;
+					return Info::empty();
+				case '*':
+				case '+':
+				case '?':
+					return self.fail();
+				default:
+					self.advance_char();
+					return self.character(start);
+				}
+			}
+
+			/// Whether a quantifier, or a `{` that may start one, is next.
+			auto at_quantifier(this const Parser& self) noexcept -> bool
+			{
+				auto c = self.peek();
+				return !self.at_end() && (c == '?' || c == '*' || c == '+' || c == '{');
+			}
+
+			/// Applies a quantifier following an atom, if there is one.
+			auto quantifier(this Parser& self, Info& atom) -> bool
+			{
+				size_t min = 0;
+				size_t max = unbounded;
+				switch (self.peek())
+				{
+				case '?':
+					max = 1;
+					self.pos += 1;
+					break;
+				case '*':
+					self.pos += 1;
+					break;
+				case '+':
+					min = 1;
+					self.pos += 1;
+					break;
+				case '{': {
+					// `{` only starts a quantifier when it is followed by a
+					// valid one, otherwise it is a literal. PCRE2 versions
+					// disagree on `{,n}` and on spaces inside the braces, so
+					// don't guess.
+					auto end = self.pos + 1;
+					auto spaced = [&] {
+						return end < self.pattern.size() && (self.pattern[end] == ' ' || self.pattern[end] == '\t');
+						};
+					auto number = [&](size_t& value) {
+						auto begin = end;
+						value = 0;
+						while (is_digit(static_cast<unit_type>(end < self.pattern.size() ? self.pattern[end] : 0))) {
+							value = std::min<size_t>(value * 10 + (self.pattern[end] - '0'), unbounded - 1);
+							end += 1;
+						}
+						return end != begin;
+						};
+					if (spaced()) {
+						self.fail();
+						return false;
+					}
+					if (!number(min)) {
+						if (end < self.pattern.size() && self.pattern[end] == ',') {
+							self.fail();
+						}
+						return false;
+					}
+					max = min;
+					if (spaced()) {
+						self.fail();
+						return false;
+					}
+					if (end < self.pattern.size() && self.pattern[end] == ',') {
+						end += 1;
+						if (spaced()) {
+							self.fail();
+							return false;
+						}
+						if (!number(max)) {
+							max = unbounded;
+						}
+						if (spaced()) {
+							self.fail();
+							return false;
+						}
+					}
+					if (end >= self.pattern.size() || self.pattern[end] != '}') {
+						return false;
+					}
+					self.pos = end + 1;
+					break;
+				}
+				default:
+					return false;
+				}
+				// Lazy and possessive forms match the same strings.
+				if (self.peek() == '?' || self.peek() == '+') {
+					self.pos += 1;
+				}
+				atom = Info::repeat(atom, min, max);
+				return true;
+			}
+
+			auto escape(this Parser& self) -> Info
+			{
+				auto start = self.pos + 1;
+				auto c = self.peek(1);
+				if (start >= self.pattern.size()) {
+					return self.fail();
+				}
+				self.pos += 2;
+				switch (c)
+				{
+				case 'a': return Info::literal(string_type(1, CharT(7)));
+				case 'e': return Info::literal(string_type(1, CharT(27)));
+				case 'f': return Info::literal(string_type(1, CharT('\f')));
+				case 'n': return Info::literal(string_type(1, CharT('\n')));
+				case 'r': return Info::literal(string_type(1, CharT('\r')));
+				case 't': return Info::literal(string_type(1, CharT('\t')));
+				// Assertions.
+				case 'b':
+				case 'B':
+				case 'A':
+				case 'z':
+				case 'Z':
+				case 'K':
+					return Info::empty();
+				case 'E':
+					return self.at_quantifier() ? self.fail() : Info::empty();
+				// Character types.
+				case 'd':
+				case 'D':
+				case 'w':
+				case 'W':
+				case 's':
+				case 'S':
+				case 'h':
+				case 'H':
+				case 'v':
+				case 'V':
+				case 'R':
+				case 'X':
+				case 'C':
+					return Info::unknown();
+				case 'p':
+				case 'P':
+					if (self.peek() == '{') {
+						while (!self.at_end() && self.peek() != '}') {
+							self.pos += 1;
+						}
+						self.pos += 1;
+					}
+					else {
+						self.pos += 1;
+					}
+					return Info::unknown();
+				case 'Q': {
+					// A quantifier after `\E` applies to the last quoted
+					// character only, so that one is kept apart.
+					auto leading = Info::empty();
+					std::optional<Info> last;
+					while (!self.at_end() && !(self.peek() == '\\' && self.peek(1) == 'E')) {
+						auto begin = self.pos;
+						self.advance_char();
+						if (last) {
+							leading = Info::concat(leading, *last);
+						}
+						last = self.character(begin);
+					}
+					if (!self.at_end()) {
+						self.pos += 2;
+					}
+					if (!last) {
+						// An empty quote is ignored, and so is a stray `\E`
+						// below: a quantifier after them applies to whatever
+						// came before.
+						return self.at_quantifier() ? self.fail() : Info::empty();
+					}
+					while (!self.failed && self.quantifier(*last)) {
+					}
+					return Info::concat(leading, *last);
+				}
+				default:
+					// A backslash before a non-alphanumeric character quotes
+					// it. Anything else (back references, \G, \x, \N, ...)
+					// isn't worth the trouble.
+					if (is_digit(c) || is_alpha(c)) {
+						return self.fail();
+					}
+					self.pos = start;
+					self.advance_char();
+					return self.character(start);
+				}
+			}
+
+			auto skip_class(this Parser& self) -> Info
+			{
+				self.pos += 1;
+				if (self.peek() == '^') {
+					self.pos += 1;
+				}
+				// A `]` right at the start is a member.
+				if (self.peek() == ']') {
+					self.pos += 1;
+				}
+				while (!self.at_end()) {
+					auto c = self.peek();
+					if (c == ']') {
+						self.pos += 1;
+						return Info::unknown();
+					}
+					if (c == '\\') {
+						if (self.peek(1) == 'Q') {
+							return self.fail();
+						}
+						self.pos += 2;
+					}
+					else if (c == '[' && self.peek(1) == ':') {
+						auto end = self.pattern.find(std::basic_string_view<CharT>(close_posix), self.pos + 2);
+						if (end == self.pattern.npos) {
+							return self.fail();
+						}
+						self.pos = end + 2;
+					}
+					else {
+						self.pos += 1;
+					}
+				}
+				return self.fail();
+			}
+
+			static constexpr CharT close_posix[] = { ':', ']', 0 };
+
+			auto group(this Parser& self) -> Info
+			{
+				self.pos += 1;
+				auto zero_width = false;
+				if (self.peek() == '*') {
+					// Verbs, and alternative spellings of assertions.
+					return self.fail();
+				}
+				if (self.peek() == '?') {
+					self.pos += 1;
+					auto c = self.peek();
+					switch (c)
+					{
+					case ':':
+					case '>':
+					case '|':
+						self.pos += 1;
+						break;
+					case '=':
+					case '!':
+						self.pos += 1;
+						zero_width = true;
+						break;
+					case '<':
+						if (self.peek(1) == '=' || self.peek(1) == '!') {
+							self.pos += 2;
+							zero_width = true;
+						}
+						else if (!self.skip_name('>')) {
+							return self.fail();
+						}
+						break;
+					case 'P':
+						if (self.peek(1) != '<') {
+							return self.fail();
+						}
+						self.pos += 1;
+						if (!self.skip_name('>')) {
+							return self.fail();
+						}
+						break;
+					case '\'':
+						if (!self.skip_name('\'')) {
+							return self.fail();
+						}
+						break;
+					case '#':
+						while (!self.at_end() && self.peek() != ')') {
+							self.pos += 1;
+						}
+						self.pos += 1;
+						return Info::empty();
+					default:
+						return self.options();
+					}
+				}
+
+				auto inner = self.alternation();
+				if (self.failed || self.peek() != ')' || self.at_end()) {
+					return self.fail();
+				}
+				self.pos += 1;
+				return zero_width ? Info::empty() : inner;
+			}
+
+			/// Skips `<name>` or `'name'` with the cursor on the opening
+			/// delimiter.
+			auto skip_name(this Parser& self, unit_type close) -> bool
+			{
+				self.pos += 1;
+				while (!self.at_end() && self.peek() != close) {
+					self.pos += 1;
+				}
+				if (self.at_end()) {
+					return false;
+				}
+				self.pos += 1;
+				return true;
+			}
+
+			/// Handles `(?flags)` and `(?flags:...)`. Turning caseless or
+			/// extended mode on changes what the rest means, so give up on
+			/// those. Turning options off is harmless. Anything that isn't an
+			/// option letter, such as `(?R)`, `(?1)`, `(?&name)` or `(?P>name)`,
+			/// is a recursion, a condition, a callout and so on, so give up on
+			/// those too.
+			auto options(this Parser& self) -> Info
+			{
+				auto on = true;
+				while (!self.at_end() && self.peek() != ')' && self.peek() != ':') {
+					switch (self.peek())
+					{
+					case '-':
+						on = false;
+						break;
+					case '^':
+						on = true;
+						break;
+					case 'i':
+					case 'x':
+						if (on) {
+							return self.fail();
+						}
+						break;
+					case 'm':
+					case 'n':
+					case 's':
+					case 'J':
+					case 'U':
+						break;
+					default:
+						return self.fail();
+					}
+					self.pos += 1;
+				}
+				if (self.at_end()) {
+					return self.fail();
+				}
+				if (self.peek() == ')') {
+					self.pos += 1;
+					return Info::empty();
+				}
+				self.pos += 1;
+				auto inner = self.alternation();
+				if (self.failed || self.peek() != ')' || self.at_end()) {
+					return self.fail();
+				}
+				self.pos += 1;
+				return inner;
+			}
+		};
+	};
+}
@@ -1,98 +1,92 @@
 ﻿#pragma once
 #define PCRE2_STATIC
 #define PCRE2_CODE_UNIT_WIDTH 0
+#include "capture_columns.h"
 #include "capture_locations.h"
+#include "interrupt.h"
+#include "literal.h"
+#include "mapped_file.h"
+#include "prefilter.h"
 #include "regex_builder.h"
+#include "replacement.h"
+#include "replacer.h"
+#include "scratch.h"
 #include "captures.h"
 #include "code.h"
 #include "config.h"
 #include "match_data.h"
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
 #include <map>
 #include <pcre2.h>
+#include <span>
+#include <thread>
+#include <vector>
 #include "pool.h"
+#include "traits.h"
+#include "work_queue.h"
 
 namespace pcre2 {
 
 	/// The type of the closure we use to create new caches. We need to spell out
 	/// all of the marker traits or else we risk leaking !MARKER impls.
-	using MatchDataPoolFn = std::function<MatchData* ()>;
+	template<typename CharT>
+	using MatchDataPoolFn = std::function<MatchData<CharT>* ()>;
 	//using MatchDataPoolFn = decltype([]() ->std::unique_ptr<MatchData> {});
 
-	using MatchDataPool = Pool<MatchData, MatchDataPoolFn>;
+	template<typename CharT>
+	using MatchDataPool = Pool<MatchData<CharT>, MatchDataPoolFn<CharT>>;
 
 	/// Same as above, but for the guard returned by a pool.
-	using MatchDataPoolGuard = Pool<MatchData, MatchDataPoolFn>::PoolGuard;
-
-	bool is_jit_available() {
-		uint32_t rc = 0;
-		auto error_code = pcre2_config_16(PCRE2_CONFIG_JIT, &rc);
-		if (error_code < 0) {
-			// If PCRE2_CONFIG_JIT is a bad option, then there's a bug somewhere.
-			//panic!("BUG: {}", Error::jit(error_code));
-		}
-		return rc == 1;
-	}
-
-	template<typename T> struct traits;
-
-	template<> struct traits<wchar_t>
+	template<typename CharT>
+	using MatchDataPoolGuard = typename Pool<MatchData<CharT>, MatchDataPoolFn<CharT>>::PoolGuard;
+
+	/// Match data borrowed for a search: from the regex's pool, from the
+	/// thread's `ScratchArena`, or from a caller's `Scratch`, in which case
+	/// there is nothing to give back.
+	template<typename CharT>
+	struct MatchDataLease
 	{
-		typedef ::pcre2_code_16* handle;
-		typedef const void* extra;
-
-		typedef wchar_t* char_ptr;
-		typedef const wchar_t* const_char_ptr;
-
-		typedef std::wstring string;
-
-		static handle compile(const_char_ptr pattern, int options,
-			int* error, const char** help, int* offset,
-			const unsigned char* table)
-		{
-			// return (::pcre16_compile2 (to(pattern), options, error, help, offset, table));
-		}
+		std::optional<MatchDataPoolGuard<CharT>> guard;
+		ScratchLease<CharT> scratch;
+		MatchData<CharT>* data;
 
-		static void release(handle pattern)
+		auto operator*(this const MatchDataLease& self) noexcept -> MatchData<CharT>&
 		{
-			::pcre2_code_free_16(pattern);
+			return *self.data;
 		}
 
-		static int query(handle pattern, extra extra, int what, void* where)
+		auto operator->(this const MatchDataLease& self) noexcept -> MatchData<CharT>*
 		{
-			// return (::pcre16_fullinfo(pattern, extra, what, where));
+			return self.data;
 		}
 
-		static int string_number(handle pattern, const_char_ptr name)
+		/// Gives the match data back before the lease is dropped.
+		static void put(MatchDataLease& lease)
 		{
-			// return (::pcre16_get_stringnumber(pattern, to(name)));
-		}
-
-		static int execute(handle pattern, extra extra,
-			const_char_ptr data, int size, int base,
-			int options, int* results, int count)
-		{
-			// return (::pcre16_exec(pattern, extra, to(data), size, base, options, results, count));
-		}
-
-		static int table_offset()
-		{
-			return (1);
-		}
-
-	private:
-		static const_char_ptr from(PCRE2_SPTR16 pointer)
-		{
-			return (reinterpret_cast<const_char_ptr>(pointer));
+			if (lease.guard) {
+				MatchDataPoolGuard<CharT>::put(*lease.guard);
+			}
+			lease.scratch.reset();
 		}
+	};
 
-		static PCRE2_SPTR16 to(const_char_ptr pointer)
-		{
-			return (reinterpret_cast<PCRE2_SPTR16>(pointer));
+	template<typename CharT = wchar_t>
+	bool is_jit_available() {
+		uint32_t rc = 0;
+		auto error_code = traits<CharT>::config(PCRE2_CONFIG_JIT, &rc);
+		if (error_code < 0) {
+			// If PCRE2_CONFIG_JIT is a bad option, then there's a bug somewhere.
+			//panic!("BUG: {}", Error::jit(error_code));
 		}
-	};
+		return rc == 1;
+	}
 
-	std::wstring escape(std::wstring_view pattern) {
-		auto is_meta_character = [](char c) -> bool {
+	template<typename CharT>
+	std::basic_string<CharT> escape(std::basic_string_view<CharT> pattern) {
+		auto is_meta_character = [](CharT c) -> bool {
 			switch (c)
 			{
 			case '\\':
@@ -121,7 +115,7 @@ namespace pcre2 {
 		// escape a pattern so that it matches literally? Wow. I couldn't
 		// find one. It does of course have \Q...\E, but, umm, what if the
 		// literal contains a \E?
-		std::wstring quoted;
+		std::basic_string<CharT> quoted;
 		quoted.reserve(pattern.size());
 		for (auto c : pattern) {
 			if (is_meta_character(c)) {
@@ -132,30 +126,75 @@ namespace pcre2 {
 		return quoted;
 	}
 
-	class wregex
+	template<typename CharT>
+	std::basic_string<CharT> escape(const CharT* pattern) {
+		return escape(std::basic_string_view<CharT>(pattern));
+	}
+
+	template<typename CharT>
+	class basic_regex
 	{
+	public:
+		using char_type = CharT;
+		using string_type = std::basic_string<CharT>;
+		using string_view_type = std::basic_string_view<CharT>;
+		using Code = pcre2::Code<CharT>;
+		using CompileContext = pcre2::CompileContext<CharT>;
+		using MatchData = pcre2::MatchData<CharT>;
+		using MatchDataPool = pcre2::MatchDataPool<CharT>;
+		using MatchDataPoolGuard = pcre2::MatchDataPoolGuard<CharT>;
+		using MatchDataLease = pcre2::MatchDataLease<CharT>;
+		using CaptureLocations = pcre2::CaptureLocations<CharT>;
+		using CaptureColumns = pcre2::CaptureColumns<CharT>;
+		using Captures = pcre2::Captures<CharT>;
+		using CapturesRef = pcre2::CapturesRef<CharT>;
+		using OwnedCaptures = pcre2::OwnedCaptures<CharT>;
+		using Replacement = pcre2::Replacement<CharT>;
+		using Scratch = pcre2::Scratch<CharT>;
+		using Match = pcre2::Match<CharT>;
+		using StreamMatch = pcre2::StreamMatch<CharT>;
 
 	private:
 		/// The configuration used to build the regex.
 		Config config;
 		/// The original pattern string.
-		std::wstring pattern;
+		string_type pattern;
 		/// The underlying compiled PCRE2 object.
 		std::unique_ptr<Code> code;
 		/// The capture group names for this regex.
-		std::unique_ptr<std::vector<std::wstring>> capture_names;
+		std::unique_ptr<std::vector<string_type>> capture_names;
 		/// A map from capture group name to capture group index.
-		std::unique_ptr<std::map<std::wstring, size_t, std::less<void>>> capture_names_idx;
+		std::unique_ptr<std::map<string_type, size_t, std::less<void>>> capture_names_idx;
 		/// A pool of mutable scratch data used by PCRE2 during matching.
 		   // MatchDataPool match_data;
 		MatchDataPool match_data;
-
-		wregex(Config config,
-			std::wstring_view pattern,
+		/// Set when the pattern matches a fixed string, which searches that
+		/// don't need capture groups look for without PCRE2.
+		std::optional<Literal<CharT>> literal;
+		/// Literal strings every match must contain, checked before handing
+		/// a search to PCRE2.
+		std::optional<Prefilter<CharT>> prefilter;
+		/// The pattern compiled with PCRE2_NO_AUTO_CAPTURE, if `captureless`
+		/// was set and the pattern has groups it can drop.
+		std::unique_ptr<Code> search_code;
+		/// Single-pair match data for `search_code`.
+		MatchDataPool search_match_data;
+		/// The pattern compiled with PCRE2_AUTO_CALLOUT, if `interruptible`
+		/// was set. It has the same groups as `code`, so it uses its match
+		/// data.
+		std::unique_ptr<Code> interrupt_code;
+
+		basic_regex(Config config,
+			string_view_type pattern,
 			std::unique_ptr<Code> code,
-			std::unique_ptr<std::vector<std::wstring>> capture_names,
-			std::unique_ptr<std::map<std::wstring, size_t, std::less<void>>> capture_names_idx,
-			MatchDataPool data
+			std::unique_ptr<std::vector<string_type>> capture_names,
+			std::unique_ptr<std::map<string_type, size_t, std::less<void>>> capture_names_idx,
+			MatchDataPool data,
+			std::optional<Literal<CharT>> literal,
+			std::optional<Prefilter<CharT>> prefilter,
+			std::unique_ptr<Code> search_code,
+			MatchDataPool search_match_data,
+			std::unique_ptr<Code> interrupt_code
 		) noexcept
 			: config(config)
 			, pattern(pattern)
@@ -163,29 +202,189 @@ namespace pcre2 {
 			, capture_names(std::move(capture_names))
 			, capture_names_idx(std::move(capture_names_idx))
 			, match_data(std::move(data))
+			, literal(std::move(literal))
+			, prefilter(std::move(prefilter))
+			, search_code(std::move(search_code))
+			, search_match_data(std::move(search_match_data))
+			, interrupt_code(std::move(interrupt_code))
+		{
+		}
 
+		/// Whether PCRE2 validates the UTF encoding of subjects for this regex.
+		inline auto is_utf(this const basic_regex& self) noexcept -> bool
 		{
+			return self.config.utf || self.config.ucp;
 		}
 
-	public:
+		/// Returns the smallest offset greater than `at` that a search may
+		/// start from. In UTF mode this skips the rest of the character at
+		/// `at`, since `PCRE2_NO_UTF_CHECK` requires the start offset to fall
+		/// on a character boundary.
+		inline auto next_start(this const basic_regex& self, string_view_type subject, size_t at) noexcept -> size_t
+		{
+			if (!self.is_utf() || at >= subject.size()) {
+				return at + 1;
+			}
+			return traits<CharT>::next_char(subject, at);
+		}
 
-		wregex(wregex&& regex) noexcept : match_data(std::move(regex.match_data))
+		/// How many code units before the start offset a search may look at,
+		/// plus one, so that a subject cut off there is never taken for the
+		/// start of the whole subject.
+		auto lookbehind_len(this const basic_regex& self) -> size_t
 		{
-			config = regex.config;
-			pattern = regex.pattern;
-			code = std::move(regex.code);
-			capture_names = std::move(regex.capture_names);
-			capture_names_idx = std::move(regex.capture_names_idx);
+			auto chars = self.match_code()->max_lookbehind().value_or(0);
+			return (chars + 1) * (self.is_utf() ? traits<CharT>::max_char_len() : 1);
 		}
 
-		wregex(const wregex& rhs) = delete;
-		wregex operator=(const wregex& rhs) = delete;
+		/// Whether `rest`, what follows a match, is a lone newline. `$` also
+		/// matches before a newline that ends the subject, which the DFA
+		/// matcher doesn't count as partial, so a partial search must not
+		/// trust such a match until it knows what comes after the newline.
+		static auto is_final_newline(string_view_type rest) noexcept -> bool
+		{
+			return (rest.size() == 1 && (rest[0] == CharT('\n') || rest[0] == CharT('\r')))
+				|| (rest.size() == 2 && rest[0] == CharT('\r') && rest[1] == CharT('\n'));
+		}
 
-		auto find_at_with_match_data(
-			this const wregex& self,
-			const MatchDataPoolGuard& match_data,
-			std::wstring_view subject,
-			size_t start
+		/// The fewest code units `par_find_all` gives a thread to search.
+		static constexpr size_t PAR_MIN_CHUNK_LEN = static_cast<size_t>(1) << 16;
+
+		/// The fewest subjects a batch search gives a thread of its own.
+		static constexpr size_t BATCH_MIN_PER_THREAD = 4096;
+		/// The most subjects a thread of a batch search takes at a time.
+		static constexpr size_t BATCH_MAX_BLOCK = 1024;
+
+		/// Calls `search(match_data, i)` for every index `i` below `count`,
+		/// on up to `threads` threads. Every thread borrows match data once
+		/// for all of its subjects. Returns the error of the lowest index
+		/// whose search failed, once all of them have run.
+		template<typename F>
+		auto run_batch(this const basic_regex& self, size_t count, size_t threads, F search)
+			-> std::expected<void, Error>
+		{
+			if (threads == 0) {
+				threads = std::max(1u, std::thread::hardware_concurrency());
+			}
+			auto workers = std::clamp<size_t>(count / BATCH_MIN_PER_THREAD, 1, threads);
+			// Blocks small enough that every worker takes a few dozen of
+			// them, so stealing can even out subjects of uneven cost.
+			WorkQueue queue(count, workers, std::min(BATCH_MAX_BLOCK, count / (workers * 32)));
+			std::vector<std::optional<std::pair<size_t, Error>>> errors(workers);
+			queue.run([&](size_t w) {
+				auto match_data = self.match_only_data();
+				while (auto block = queue.take(w)) {
+					for (auto i = block->first; i < block->second; i++) {
+						auto rc = search(*match_data, i);
+						if (!rc && (!errors[w] || i < errors[w]->first)) {
+							errors[w] = std::make_pair(i, rc.error());
+						}
+					}
+				}
+				MatchDataLease::put(match_data);
+				});
+
+			std::optional<std::pair<size_t, Error>> first;
+			for (const auto& error : errors) {
+				if (error && (!first || error->first < first->first)) {
+					first = error;
+				}
+			}
+			if (first) {
+				return std::unexpected(first->second);
+			}
+			return {};
+		}
+
+		/// The walk one thread of `par_find_all` makes through its chunk.
+		struct ChunkMatches
+		{
+			/// The matches found, up to and including the first one that
+			/// starts in a later chunk.
+			std::vector<Match> matches;
+			/// Where the next search started after each match.
+			std::vector<size_t> next_starts;
+			/// The error the walk stopped at, if any.
+			std::optional<Error> error;
+			/// Whether the walk ran out of matches.
+			bool finished = false;
+		};
+
+		/// Runs the prefilter for a search starting at `start`. Returns the
+		/// offset PCRE2 should start from instead, or `nullopt` if there can't
+		/// be a match. Adds `PCRE2_NO_UTF_CHECK` to `options` if it had to
+		/// validate the subject itself.
+		auto prefilter_at(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			uint32_t& options
+		) noexcept -> std::optional<size_t> {
+			if (!self.prefilter || start > subject.size()) {
+				return start;
+			}
+			// Rejecting an invalid subject would hide PCRE2's error, so
+			// validate it first. Checking both halves also catches a start
+			// offset in the middle of a character.
+			if (self.config.utf && !self.config.ucp && (options & PCRE2_NO_UTF_CHECK) == 0) {
+				if (!traits<CharT>::valid_utf(subject.substr(0, start))
+					|| !traits<CharT>::valid_utf(subject.substr(start))) {
+					return start;
+				}
+				options |= PCRE2_NO_UTF_CHECK;
+			}
+			return self.prefilter->start_at(subject, start);
+		}
+
+		/// The code to run searches that only report the overall match.
+		inline auto match_code(this const basic_regex& self) noexcept -> const Code*
+		{
+			return self.search_code ? self.search_code.get() : self.code.get();
+		}
+
+		/// Borrows match data for searches against `code`, or against
+		/// `match_code` if `match_only` is set.
+		auto borrow(this const basic_regex& self, bool match_only = false) -> MatchDataLease
+		{
+			auto captureless = match_only && self.search_code;
+			if (self.config.match_config.shared_scratch) {
+				auto pairs = captureless ? 1 : static_cast<uint32_t>(self.capture_names->size());
+				auto& arena = ScratchArena<CharT>::local();
+				auto data = arena.acquire(pairs, self.config.match_config);
+				auto ptr = data.get();
+				return MatchDataLease{ std::nullopt, ScratchLease<CharT>(arena, std::move(data)), ptr };
+			}
+			auto guard = captureless ? self.search_match_data.get() : self.match_data.get();
+			auto ptr = &guard.deref_mut();
+			return MatchDataLease{ std::move(guard), {}, ptr };
+		}
+
+		/// Match data for searches against `match_code`.
+		inline auto match_only_data(this const basic_regex& self) -> MatchDataLease
+		{
+			return self.borrow(true);
+		}
+
+		/// Searches for a match whose capture groups are read afterwards, so
+		/// it always backtracks. See `MatchData::find_backtracking`.
+		auto find_at_with_options(
+			this const basic_regex& self,
+			const MatchData& match_data,
+			string_view_type subject,
+			size_t start,
+			uint32_t options
+		) -> std::expected<std::optional<Match>, Error> {
+			return self.find_at_with_code(self.code.get(), match_data, subject, start, options, true);
+		}
+
+		auto find_at_with_code(
+			this const basic_regex& self,
+			const Code* code,
+			const MatchData& match_data,
+			string_view_type subject,
+			size_t start,
+			uint32_t options,
+			bool groups = false
 		) -> std::expected<std::optional<Match>, Error> {
 			assert(
 				start <= subject.size(),
@@ -194,23 +393,335 @@ namespace pcre2 {
 				subject.size()
 			);
 
-			uint32_t options = 0;
-			// SAFETY: We don't use any dangerous PCRE2 options.
-			return match_data->find(
-				self.code.get(),
-				subject,
-				start,
-				options)
+			auto at = self.prefilter_at(subject, start, options);
+			if (!at) {
+				return std::nullopt;
+			}
+
+			auto found = groups
+				? match_data.find_backtracking(code, subject, *at, options)
+				: match_data.find(code, subject, *at, options);
+			return found
 				.transform([&](bool b) -> std::optional<Match>
 					{
 						if (b) {
-							auto ovector = match_data->ovector();
+							auto ovector = match_data.ovector();
 							return std::make_optional<Match>(subject.data(), ovector[0], ovector[1]);
 						}
 						return std::nullopt;
 					});
 		}
 
+		/// Searches with `literal` if the pattern is a fixed string. Returns
+		/// `nullopt` if PCRE2 has to do the search instead, which includes
+		/// subjects that aren't valid UTF so that PCRE2 reports the error.
+		auto find_literal_at(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			uint32_t options
+		) noexcept -> std::optional<std::optional<Match>> {
+			if (!self.literal || start > subject.size()) {
+				return std::nullopt;
+			}
+			// PCRE2_MATCH_INVALID_UTF (implied by `ucp`) makes invalid
+			// subjects searchable, so only plain `utf` needs the check.
+			if (self.config.utf
+				&& !self.config.ucp
+				&& (options & PCRE2_NO_UTF_CHECK) == 0
+				&& !traits<CharT>::valid_utf(subject.substr(start))) {
+				return std::nullopt;
+			}
+			return self.literal->find(subject, start).transform([&](size_t at)
+				{
+					return Match{ subject.data(), at, at + self.literal->needle.size() };
+				});
+		}
+
+		/// Like `find_at_with_options`, but uses the literal fast path when it
+		/// applies and otherwise searches with `match_code`. `match_data` must
+		/// come from `match_only_data` or a `Scratch`, and capture groups
+		/// must not be read from it afterwards.
+		auto find_at_with_literal(
+			this const basic_regex& self,
+			const MatchData& match_data,
+			string_view_type subject,
+			size_t start,
+			uint32_t options
+		) -> std::expected<std::optional<Match>, Error> {
+			if (auto m = self.find_literal_at(subject, start, options)) {
+				return *m;
+			}
+			return self.find_at_with_code(self.match_code(), match_data, subject, start, options);
+		}
+
+		/// Searches with `scratch` if given, or with match data from the pool
+		/// otherwise.
+		auto is_match_at_with_options(
+			this const basic_regex& self,
+			const MatchData* scratch,
+			string_view_type subject,
+			size_t start,
+			uint32_t options
+		) -> std::expected<bool, Error> {
+			assert(
+				start <= subject.size(),
+				"start ({}) must be <= subject.len() ({})",
+				start,
+				subject.size()
+			);
+
+			if (auto m = self.find_literal_at(subject, start, options)) {
+				return m->has_value();
+			}
+			auto at = self.prefilter_at(subject, start, options);
+			if (!at) {
+				return false;
+			}
+			// Any match will do, so the DFA matcher can stop at the first
+			// one it sees rather than keep going for the longest.
+			if (self.config.match_config.engine == MatchEngine::Dfa) {
+				options |= PCRE2_DFA_SHORTEST;
+			}
+			if (scratch) {
+				return scratch->find(self.match_code(), subject, *at, options);
+			}
+
+			auto match_data = self.match_only_data();
+			auto res =
+				match_data->find(self.match_code(), subject, *at, options);
+			MatchDataLease::put(match_data);
+			return res;
+		}
+
+		/// Expands a precompiled replacement for at most `limit` matches (0
+		/// means all) into `output`. Matches are found the way
+		/// `pcre2_substitute` finds them, so the result is the same as with
+		/// the template string: after an empty match the next search starts
+		/// at the same offset but may not match empty there, and if it fails
+		/// one character is copied and searching goes on after it. Returns
+		/// false if there is no match. `output` is only written once the
+		/// whole substitution succeeded.
+		auto substitute_with_replacement(
+			this const basic_regex& self,
+			string_view_type subject,
+			const Replacement& replacement,
+			size_t limit,
+			string_type& output
+		) -> std::expected<bool, Error> {
+			uint32_t options = 0;
+			auto at = self.prefilter_at(subject, 0, options);
+			if (!at) {
+				return false;
+			}
+
+			auto match_data = self.borrow();
+			string_type result;
+			size_t last = 0;
+			size_t start = *at;
+			size_t count = 0;
+			// PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED after an empty match.
+			uint32_t retry = 0;
+			while (true) {
+				auto found = match_data->find_backtracking(self.code.get(), subject, start, options | retry);
+				if (!found) {
+					MatchDataLease::put(match_data);
+					return std::unexpected(found.error());
+				}
+				options |= PCRE2_NO_UTF_CHECK;
+				if (!*found) {
+					if (retry == 0 || start >= subject.size()) {
+						break;
+					}
+					// Step over one character, or a CRLF pair when that is
+					// a newline, as `pcre2_substitute` does.
+					start = self.next_start(subject, start);
+					if (self.config.crlf
+						&& subject[start - 1] == CharT('\r')
+						&& start < subject.size()
+						&& subject[start] == CharT('\n')) {
+						start += 1;
+					}
+					retry = 0;
+					if (auto next = self.prefilter_at(subject, start, options)) {
+						start = *next;
+						continue;
+					}
+					break;
+				}
+
+				auto ovector = match_data->ovector();
+				if (count == 0) {
+					result.reserve(subject.size());
+				}
+				result.append(subject.substr(last, ovector[0] - last));
+				replacement.append(
+					CapturesRef{ subject.data(), ovector, self.capture_names_idx.get() },
+					std::back_inserter(result));
+				last = ovector[1];
+				start = ovector[1];
+				count += 1;
+				if (count == limit) {
+					break;
+				}
+				if (ovector[0] == ovector[1]) {
+					if (start == subject.size()) {
+						break;
+					}
+					retry = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
+				}
+				else {
+					retry = 0;
+					auto next = self.prefilter_at(subject, start, options);
+					if (!next) {
+						break;
+					}
+					start = *next;
+				}
+			}
+			MatchDataLease::put(match_data);
+
+			if (count == 0) {
+				return false;
+			}
+			result.append(subject.substr(last));
+			output = std::move(result);
+			return true;
+		}
+
+		/// `substitute_with_options` for a fixed-string pattern, without
+		/// PCRE2. Returns `nullopt` if PCRE2 has to do it, for example because
+		/// the replacement uses syntax `Replacement` doesn't support or
+		/// `options` asks for anything but a plain or global substitution
+		/// with the syntax of `substitute`.
+		auto substitute_literal(
+			this const basic_regex& self,
+			string_view_type subject,
+			string_view_type replacement,
+			uint32_t options,
+			string_type& output
+		) -> std::optional<bool> {
+			// `Replacement` implements the syntax of `SUBSTITUTE_MATCHED` and
+			// nothing else, such as PCRE2_SUBSTITUTE_LITERAL or
+			// PCRE2_SUBSTITUTE_REPLACEMENT_ONLY.
+			auto syntax = options & ~(PCRE2_SUBSTITUTE_GLOBAL | PCRE2_NO_UTF_CHECK);
+			if (syntax != SUBSTITUTE_MATCHED) {
+				return std::nullopt;
+			}
+			auto first = self.find_literal_at(subject, 0, options);
+			if (!first) {
+				return std::nullopt;
+			}
+			if (!*first) {
+				return false;
+			}
+			if (self.is_utf()
+				&& (options & PCRE2_NO_UTF_CHECK) == 0
+				&& !traits<CharT>::valid_utf(replacement)) {
+				return false;
+			}
+			auto compiled = Replacement::compile(replacement, 1, *self.capture_names_idx);
+			if (!compiled) {
+				return std::nullopt;
+			}
+
+			output.clear();
+			output.reserve(subject.size());
+			auto out = std::back_inserter(output);
+			auto n = self.literal->needle.size();
+			std::optional<size_t> at = (*first)->start;
+			size_t last = 0;
+			while (at) {
+				out = std::copy(subject.begin() + last, subject.begin() + *at, out);
+				std::array<size_t, 2> ovector{ *at, *at + n };
+				out = compiled->expand(subject.data(), ovector, out);
+				last = *at + n;
+				if ((options & PCRE2_SUBSTITUTE_GLOBAL) == 0) {
+					break;
+				}
+				at = self.literal->find(subject, last);
+			}
+			std::copy(subject.begin() + last, subject.end(), out);
+			return true;
+		}
+
+		auto find_at_with_pool(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			uint32_t options
+		) -> std::expected<std::optional<Match>, Error> {
+			if (auto m = self.find_literal_at(subject, start, options)) {
+				return *m;
+			}
+
+			auto match_data = self.match_only_data();
+			auto res =
+				self.find_at_with_code(self.match_code(), *match_data, subject, start, options);
+			MatchDataLease::put(match_data);
+			return res;
+		}
+
+		/// Runs a search that gives up when `interrupt` says so. The literal
+		/// fast path takes linear time, so it isn't checked.
+		auto find_at_with_interrupt(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			const Interrupt& interrupt
+		) -> std::expected<std::optional<Match>, Error> {
+			if (auto m = self.find_literal_at(subject, start, 0)) {
+				return *m;
+			}
+			if (auto error = interrupt.check()) {
+				return std::unexpected(*error);
+			}
+
+			auto code = self.interrupt_code ? self.interrupt_code.get() : self.code.get();
+			auto match_data = self.borrow();
+			auto res = [&]() -> std::expected<std::optional<Match>, Error>
+				{
+					auto guard = InterruptGuard<CharT>(match_data->match_context, interrupt);
+					auto res = self.find_at_with_code(code, *match_data, subject, start, 0);
+					if (!res && guard.error()) {
+						return std::unexpected(*guard.error());
+					}
+					return res;
+				}();
+			MatchDataLease::put(match_data);
+			return res;
+		}
+
+	public:
+
+		basic_regex(basic_regex&& regex) noexcept
+			: match_data(std::move(regex.match_data))
+			, search_match_data(std::move(regex.search_match_data))
+		{
+			config = regex.config;
+			pattern = regex.pattern;
+			code = std::move(regex.code);
+			capture_names = std::move(regex.capture_names);
+			capture_names_idx = std::move(regex.capture_names_idx);
+			literal = std::move(regex.literal);
+			prefilter = std::move(regex.prefilter);
+			search_code = std::move(regex.search_code);
+			interrupt_code = std::move(regex.interrupt_code);
+		}
+
+		basic_regex(const basic_regex& rhs) = delete;
+		basic_regex operator=(const basic_regex& rhs) = delete;
+
+		auto find_at_with_match_data(
+			this const basic_regex& self,
+			const MatchDataPoolGuard& match_data,
+			string_view_type subject,
+			size_t start
+		) -> std::expected<std::optional<Match>, Error> {
+			// SAFETY: We don't use any dangerous PCRE2 options.
+			return self.find_at_with_code(self.code.get(), *match_data, subject, start, 0);
+		}
+
 		/// Returns the same as `captures_read`, but starts the search at the given
 		/// offset and populates the capture locations given.
 		///
@@ -218,92 +729,127 @@ namespace pcre2 {
 		/// context into consideration. For example, the `\A` anchor can only
 		/// match when `start == 0`.
 		auto captures_read_at(
-			this const wregex& self,
+			this const basic_regex& self,
 			CaptureLocations& locs,
-			std::wstring_view subject,
+			string_view_type subject,
 			size_t start
 		) -> std::expected<std::optional<Match>, Error> {
-			assert(
-				start <= subject.size(),
-				"start ({}) must be <= subject.len() ({})",
-				start,
-				subject.size()
-			);
-
-			uint32_t options = 0;
 			// SAFETY: We don't use any dangerous PCRE2 options.
-			return locs.data->find(
-				self.code.get(),
-				subject,
-				start,
-				options)
-				.transform([&](bool b) -> std::optional<Match>
-					{
-						if (b) {
-							auto ovector = locs.data->ovector();
-							return std::make_optional<Match>(subject.data(), ovector[0], ovector[1]);
-						}
-						return std::nullopt;
-					});
+			return self.find_at_with_options(*locs.data, subject, start, 0);
+		}
+
+		/// Like `captures_read_at`, but leaves the capture groups in the
+		/// caller's scratch space, where `Scratch::get` reads them.
+		auto captures_read_at(
+			this const basic_regex& self,
+			Scratch& scratch,
+			string_view_type subject,
+			size_t start
+		) -> std::expected<std::optional<Match>, Error> {
+			assert(scratch.code == self.code.get(), "scratch space belongs to another regex");
+			return self.find_at_with_options(*scratch.data, subject, start, 0);
+		}
+
+		/// Searches every line in `lines` for its first match and writes the
+		/// offsets of every capture group into `out`, a column per group
+		/// named after `capture_names`. Nothing is allocated per line, and
+		/// `out` keeps its memory from one batch to the next, so the result
+		/// can go into a columnar store as is.
+		///
+		/// Offsets are stored as `uint32_t`, so lines must be shorter than
+		/// 4 GiB. On error `out` holds the lines before the failed one.
+		auto extract_columns(
+			this const basic_regex& self,
+			std::span<const string_view_type> lines,
+			CaptureColumns& out
+		) -> std::expected<void, Error> {
+			out.reset(*self.capture_names, lines.size());
+			auto match_data = self.borrow();
+			for (size_t row = 0; row < lines.size(); row++) {
+				auto line = lines[row];
+				assert(line.size() <= std::numeric_limits<uint32_t>::max(), "line {} is too long for 32-bit offsets", row);
+				auto found = self.find_at_with_options(*match_data, line, 0, 0);
+				if (!found) {
+					MatchDataLease::put(match_data);
+					return std::unexpected(found.error());
+				}
+				if (!*found) {
+					continue;
+				}
+				auto ovector = match_data->ovector();
+				for (size_t group = 0; group < out.columns.size(); group++) {
+					if (auto span = capture_at(ovector, group)) {
+						auto& column = out.columns[group];
+						column.offsets[2 * row] = static_cast<uint32_t>(std::get<0>(*span));
+						column.offsets[2 * row + 1] = static_cast<uint32_t>(std::get<1>(*span));
+						column.valid[row / 64] |= static_cast<uint64_t>(1) << (row % 64);
+					}
+				}
+			}
+			MatchDataLease::put(match_data);
+			return {};
 		}
 
-		static inline auto jit_compile(std::wstring_view pattern) -> std::expected<wregex, Error>
+		static inline auto jit_compile(string_view_type pattern) -> std::expected<basic_regex, Error>
 		{
 			auto options = RegexOptions{};
 			options.jit(true);
 			return jit_compile(pattern, options);
 		}
 
-		static auto jit_compile(std::wstring_view pattern, RegexOptions& s) -> std::expected<wregex, Error>
+		static auto jit_compile(string_view_type pattern, RegexOptions& s) -> std::expected<basic_regex, Error>
 		{
-			uint32_t options = 0;
 			Config config = s.config;
-			if (config.caseless) {
-				options |= PCRE2_CASELESS;
-			}
-			if (config.dotall) {
-				options |= PCRE2_DOTALL;
-			}
-			if (config.extended) {
-				options |= PCRE2_EXTENDED;
-			}
-			if (config.multi_line) {
-				options |= PCRE2_MULTILINE;
-			}
-			if (config.ucp) {
-				options |= PCRE2_UCP;
-				options |= PCRE2_UTF;
-				options |= PCRE2_MATCH_INVALID_UTF;
-			}
-			if (config.utf) {
-				options |= PCRE2_UTF;
-			}
+			uint32_t options = config.compile_options();
+			auto general_context = GeneralContext<CharT>::make_shared(config.allocator);
 
-			auto ctx = std::make_unique<CompileContext>();
-			if (config.crlf) {
-				auto rc = ctx->set_newline(PCRE2_NEWLINE_ANYCRLF);
-				if (!rc) return std::unexpected(rc.error());
-			}
+			auto compile = [&](uint32_t options) -> std::expected<std::unique_ptr<Code>, Error>
+				{
+					auto ctx = std::make_unique<CompileContext>(general_context);
+					if (config.crlf) {
+						auto rc = ctx->set_newline(PCRE2_NEWLINE_ANYCRLF);
+						if (!rc) return std::unexpected(rc.error());
+					}
+					// The DFA matcher never runs JIT compiled code.
+					auto jit = config.match_config.engine == MatchEngine::Dfa
+						? JITChoice::Never
+						: config.jit;
+					return Code::make_unique(pattern, options, std::move(ctx))
+						.transform([&](auto code)
+							{
+								auto modes = config.streaming
+									? PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_HARD
+									: PCRE2_JIT_COMPLETE;
+								switch (jit)
+								{
+								case JITChoice::Never:
+									break;
+								case JITChoice::Always:
+									code->jit_compile(modes);
+									break;
+								case JITChoice::Attempt:
+									if (auto rc = code->jit_compile(modes); !rc) {
+										//log::debug!("JIT compilation failed: {}", err);
+									}
+									break;
+								}
+								return code;
+							});
+				};
 
-			return Code::make_unique(pattern, options, std::move(ctx))
-				.transform([&](auto code) -> wregex
+			return compile(options)
+				.transform([&](auto code) -> basic_regex
 					{
-						switch (config.jit)
-						{
-						case JITChoice::Never:
-							break;
-						case JITChoice::Always:
-							code->jit_compile();
-							break;
-						case JITChoice::Attempt:
-							if (auto rc = code->jit_compile(); !rc) {
-								//log::debug!("JIT compilation failed: {}", err);
-							}
-							break;
-						}
+
+						// A fixed string doesn't need a prefilter, it skips PCRE2
+						// altogether.
+						auto literal = Literal<CharT>::parse(pattern, config);
+						auto prefilter = literal
+							? std::nullopt
+							: Prefilter<CharT>::analyze(pattern, config);
 
 						auto capture_names = code->capture_names();
-						auto idx = std::make_unique<std::map<std::wstring, size_t, std::less<void>>>();
+						auto idx = std::make_unique<std::map<string_type, size_t, std::less<void>>>();
 						for (size_t i = 0; i < capture_names.size(); i++)
 						{
 							if (auto name = capture_names[i]; !name.empty())
@@ -312,75 +858,201 @@ namespace pcre2 {
 							}
 						}
 
-						auto match_data = MatchDataPool::create(
-							[code = code.get(), config = config.match_config]()
-							{
-								return new MatchData(config, code);
-							});
+						// With shared scratch, searches borrow from the thread's
+						// arena and the regex gets no pools at all.
+						auto shared = config.match_config.shared_scratch;
+						auto match_data = shared
+							? MatchDataPool()
+							: MatchDataPool::create(
+								[code = code.get(), config = config.match_config]()
+								{
+									return new MatchData(config, code);
+								},
+								config.match_config.shards);
+
+						// Named groups still capture under PCRE2_NO_AUTO_CAPTURE
+						// and get renumbered, which would change what numbered
+						// references point at, so only unnamed groups are
+						// dropped. A numbered reference then fails to compile
+						// and the full code is used instead.
+						std::unique_ptr<Code> search_code;
+						if (config.captureless
+							&& !literal
+							&& capture_names.size() > 1
+							&& idx->empty()) {
+							if (auto c = compile(options | PCRE2_NO_AUTO_CAPTURE)) {
+								search_code = std::move(*c);
+							}
+						}
+						auto search_match_data = search_code && !shared
+							? MatchDataPool::create(
+								[code = search_code.get(), config = config.match_config]()
+								{
+									return new MatchData(config, code);
+								},
+								config.match_config.shards)
+							: MatchDataPool();
+
+						// Fixed strings are searched for without PCRE2 and
+						// never need stopping.
+						std::unique_ptr<Code> interrupt_code;
+						if (config.interruptible && !literal) {
+							if (auto c = compile(options | PCRE2_AUTO_CALLOUT)) {
+								interrupt_code = std::move(*c);
+							}
+						}
 
-						return wregex(config, pattern, std::move(code),
-							std::make_unique<std::vector<std::wstring>>(std::move(capture_names)),
+						return basic_regex(config, pattern, std::move(code),
+							std::make_unique<std::vector<string_type>>(std::move(capture_names)),
 							std::move(idx),
-							std::move(match_data)
+							std::move(match_data),
+							std::move(literal),
+							std::move(prefilter),
+							std::move(search_code),
+							std::move(search_match_data),
+							std::move(interrupt_code)
 						);
 					});
 		}
 
-		inline auto as_str(this const wregex& self) -> std::wstring_view
+		inline auto as_str(this const basic_regex& self) -> string_view_type
 		{
 			return self.pattern;
 		}
 
-		operator std::wstring_view(this const wregex& self) noexcept
+		operator string_view_type(this const basic_regex& self) noexcept
 		{
 			return self.pattern;
 		}
 
-		auto captures_len(this const wregex& self) -> size_t
+		auto captures_len(this const basic_regex& self) -> size_t
 		{
 			return self.code->capture_count().value();// .expect("a valid capture count from PCRE2")
 		}
 
 		/// Returns an empty set of capture locations that can be reused in
 		/// multiple calls to `captures_read` or `captures_read_at`.
-		inline auto capture_locations(this const wregex& self) -> CaptureLocations
+		inline auto capture_locations(this const basic_regex& self) -> CaptureLocations
 		{
 			return CaptureLocations{ self.code.get(), self.new_match_data() };
 		}
 
-		inline auto new_match_data(this const wregex& self) -> std::unique_ptr<MatchData>
+		inline auto new_match_data(this const basic_regex& self) -> std::unique_ptr<MatchData>
 		{
 			return std::make_unique<MatchData>(self.config.match_config, self.code.get());
 		}
 
-		// 检查给定的字符串是否匹配正则表达式
-		auto is_match_at(
-			this const wregex& self,
-			std::wstring_view subject,
-			size_t start
-		) -> std::expected<bool, Error> {
-			assert(
-				start <= subject.size(),
-				"start ({}) must be <= subject.len() ({})",
-				start,
-				subject.size()
-			);
+		/// Creates scratch space for searching with this regex without going
+		/// through its pool. See `Scratch`.
+		inline auto new_scratch(this const basic_regex& self) -> Scratch
+		{
+			return Scratch{ self.code.get(), self.new_match_data() };
+		}
 
-			uint32_t options = 0;
-			auto match_data = self.match_data();
+		/// Creates the match data for `n` simultaneous searches up front, so
+		/// that the first searches after startup don't pay for allocating it
+		/// (and its JIT stack, with `max_jit_stack_size`).
+		///
+		/// With `shared_scratch` this sizes the calling thread's arena for
+		/// this regex instead, which only ever needs one entry.
+		void prewarm(this const basic_regex& self, size_t n)
+		{
+			if (self.config.match_config.shared_scratch) {
+				if (n > 0) {
+					self.borrow();
+				}
+				return;
+			}
+			self.match_data.prewarm(n);
+			if (self.search_code) {
+				self.search_match_data.prewarm(n);
+			}
+		}
+
+		/// Frees the match data kept for searches that aren't running. The
+		/// pool also does this on its own for match data that goes unused,
+		/// but only while the regex is still being searched.
+		///
+		/// With `shared_scratch` this frees the calling thread's arena, which
+		/// affects every regex using it.
+		void trim_scratch(this const basic_regex& self) noexcept
+		{
+			if (self.config.match_config.shared_scratch) {
+				ScratchArena<CharT>::local().trim();
+				return;
+			}
+			self.match_data.trim();
+			if (self.search_code) {
+				self.search_match_data.trim();
+			}
+		}
+
+		// 检查给定的字符串是否匹配正则表达式
+		auto is_match_at(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start
+		) -> std::expected<bool, Error> {
 			// SAFETY: We don't use any dangerous PCRE2 options.
-			auto res =
-				match_data->find(self.code.get(), subject, start, options);
-			MatchDataPoolGuard::put(match_data);
-			return res;
+			return self.is_match_at_with_options(nullptr, subject, start, 0);
+		}
+
+		/// Like `is_match_at`, but skips UTF validation of the subject.
+		auto is_match_at(
+			this const basic_regex& self,
+			trusted_utf<CharT> subject,
+			size_t start
+		) -> std::expected<bool, Error> {
+			return self.is_match_at_with_options(nullptr, subject.subject, start, PCRE2_NO_UTF_CHECK);
+		}
+
+		/// Like `is_match_at`, but searches with the caller's scratch space
+		/// instead of match data from the pool.
+		auto is_match_at(
+			this const basic_regex& self,
+			Scratch& scratch,
+			string_view_type subject,
+			size_t start
+		) -> std::expected<bool, Error> {
+			assert(scratch.code == self.code.get(), "scratch space belongs to another regex");
+			return self.is_match_at_with_options(scratch.data.get(), subject, start, 0);
+		}
+
+		/// Like `is_match_at`, but fails with `ErrorKind::Timeout` once
+		/// `deadline` has passed. See `RegexOptions::interruptible`.
+		auto is_match_at(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			std::chrono::steady_clock::time_point deadline
+		) -> std::expected<bool, Error> {
+			return self.find_at_with_interrupt(subject, start, Interrupt{ deadline })
+				.transform([](const auto& m) { return m.has_value(); });
+		}
+
+		/// Like `is_match_at`, but fails with `ErrorKind::Cancelled` once
+		/// `token` is cancelled. See `RegexOptions::interruptible`.
+		auto is_match_at(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			const CancellationToken& token
+		) -> std::expected<bool, Error> {
+			return self.find_at_with_interrupt(subject, start, Interrupt{ std::nullopt, &token })
+				.transform([](const auto& m) { return m.has_value(); });
 		}
 
 		struct Matches {
-			const wregex& re;
-			MatchDataPoolGuard match_data;
-			std::wstring_view subject;
+			const basic_regex& re;
+			/// Holds the match data while iterating, unless the caller passed
+			/// in their own `Scratch`.
+			MatchDataLease match_data;
+			string_view_type subject;
 			size_t last_end;
 			std::optional<size_t> last_match;
+			/// Options passed to every search. `PCRE2_NO_UTF_CHECK` is added
+			/// once the first search has validated the subject.
+			uint32_t options;
 
 			struct iterator
 			{
@@ -473,16 +1145,21 @@ namespace pcre2 {
 					return std::nullopt;
 				}
 
-				auto res = self.re.find_at_with_match_data(
-					self.match_data,
+				auto res = self.re.find_at_with_literal(
+					*self.match_data,
 					self.subject,
-					self.last_end
+					self.last_end,
+					self.options
 				);
 
 				if (!res) {
 					return std::unexpected(Error(res.error()));
 				}
-				else if (!*res) {
+				// PCRE2 checks the UTF validity of everything from the start
+				// offset onwards, so one successful search is enough to trust
+				// the rest of the subject.
+				self.options |= PCRE2_NO_UTF_CHECK;
+				if (!*res) {
 					return std::nullopt;
 				}
 
@@ -492,7 +1169,7 @@ namespace pcre2 {
 					// This is an empty match. To ensure we make progress, start
 					// the next search at the smallest possible starting position
 					// of the next match following this one.
-					self.last_end = m.end + 1;
+					self.last_end = self.re.next_start(self.subject, m.end);
 					// Don't accept empty matches immediately following a match.
 					// Just move on to the next match.
 					if (self.last_match && m.end == self.last_match) {
@@ -509,19 +1186,466 @@ namespace pcre2 {
 
 		struct CaptureMatches
 		{
-			const wregex& re;
-			std::wstring_view subject;
+			const basic_regex& re;
+			string_view_type subject;
 			size_t last_end;
 			std::optional<size_t> last_match;
+			/// Options passed to every search. `PCRE2_NO_UTF_CHECK` is added
+			/// once the first search has validated the subject.
+			uint32_t options;
 
 			struct iterator
 			{
 				using difference_type = std::ptrdiff_t;
 				using element_type = std::expected<Captures, Error>;
 				using pointer = element_type*;
-				using reference = element_type&;
+				using reference = element_type&;
+
+				const element_type& operator*(this const iterator& self)
+				{
+					if (!self.current)
+					{
+						throw "at the end";
+					}
+					return self.current.value();
+				}
+
+				iterator& operator++(this iterator& self)
+				{
+					if (!self.current)
+					{
+						throw "at the end";
+					}
+
+					if (auto v = self.matches->next()) {
+						self.current = std::move(v);
+					}
+					else {
+						self.current = std::nullopt;
+					}
+
+					++self.index;
+
+					return self;
+				}
+
+				bool operator==(const iterator& iter)
+				{
+					if (!iter.current && !current) return true;
+					return iter.matches == matches && iter.index == index;
+				}
+
+				bool operator!=(const iterator& iter)
+				{
+					if (!iter.current && !current) {
+						return false;
+					}
+					return iter.matches != matches || iter.index != index;
+				}
+
+				iterator(CaptureMatches* matches,
+					std::optional<std::expected<Captures, Error>>&& start)
+					noexcept : matches(matches), current(std::move(start)), index(0)
+				{
+
+				}
+
+				iterator(CaptureMatches* matches) noexcept : matches(matches), index(-1) {}
+
+				~iterator() = default;
+
+			private:
+				CaptureMatches* matches;
+				std::optional<std::expected<Captures, Error>> current;
+				int index;
+			};
+
+			auto begin() { return iterator(this, next()); };
+
+			auto end() { return iterator(this); };
+
+			auto next(this CaptureMatches& self) -> std::optional<std::expected<Captures, Error>>
+			{
+				if (self.last_end > self.subject.size()) {
+					return std::nullopt;
+				}
+				auto locs = self.re.capture_locations();
+				auto res =
+					self.re.find_at_with_options(*locs.data, self.subject, self.last_end, self.options);
+
+				if (!res) {
+					return std::unexpected(Error(res.error()));
+				}
+				self.options |= PCRE2_NO_UTF_CHECK;
+				if (!*res) {
+					return std::nullopt;
+				}
+
+				auto& m = **res;
+				if (m.start == m.end) {
+					// This is an empty match. To ensure we make progress, start
+					// the next search at the smallest possible starting position
+					// of the next match following this one.
+					self.last_end = self.re.next_start(self.subject, m.end);
+					// Don't accept empty matches immediately following a match.
+					// Just move on to the next match.
+					if (self.last_match && *self.last_match == m.end) {
+						return self.next();
+					}
+				}
+				else {
+					self.last_end = m.end;
+				}
+				self.last_match = m.end;
+				return Captures{
+					self.subject.data(),
+					std::move(locs),
+					self.re.capture_names_idx.get()
+				};
+			}
+		};
+
+		/// Like `CaptureMatches`, but reuses one borrowed `MatchData` for every
+		/// match instead of giving each its own, and yields views of it.
+		struct CaptureMatchesRef
+		{
+			const basic_regex& re;
+			/// One borrowed `MatchData` reused for every match. The yielded
+			/// `CapturesRef` values borrow its ovector.
+			MatchDataLease match_data;
+			string_view_type subject;
+			size_t last_end;
+			std::optional<size_t> last_match;
+			/// Options passed to every search. `PCRE2_NO_UTF_CHECK` is added
+			/// once the first search has validated the subject.
+			uint32_t options;
+
+			struct iterator
+			{
+				using difference_type = std::ptrdiff_t;
+				using element_type = std::expected<CapturesRef, Error>;
+				using pointer = element_type*;
+				using reference = element_type&;
+
+				const element_type& operator*(this const iterator& self)
+				{
+					if (!self.current)
+					{
+						throw "at the end";
+					}
+					return self.current.value();
+				}
+
+				iterator& operator++(this iterator& self)
+				{
+					if (!self.current)
+					{
+						throw "at the end";
+					}
+
+					if (auto v = self.matches->next()) {
+						self.current = std::move(v);
+					}
+					else {
+						self.current = std::nullopt;
+					}
+
+					++self.index;
+
+					return self;
+				}
+
+				bool operator==(const iterator& iter)
+				{
+					if (!iter.current && !current) return true;
+					return iter.matches == matches && iter.index == index;
+				}
+
+				bool operator!=(const iterator& iter)
+				{
+					if (!iter.current && !current) {
+						return false;
+					}
+					return iter.matches != matches || iter.index != index;
+				}
+
+				iterator(CaptureMatchesRef* matches,
+					std::optional<std::expected<CapturesRef, Error>>&& start)
+					noexcept : matches(matches), current(std::move(start)), index(0)
+				{
+
+				}
+
+				iterator(CaptureMatchesRef* matches) noexcept : matches(matches), index(-1) {}
+
+				~iterator() = default;
+
+			private:
+				CaptureMatchesRef* matches;
+				std::optional<std::expected<CapturesRef, Error>> current;
+				int index;
+			};
+
+			auto begin() { return iterator(this, next()); };
+
+			auto end() { return iterator(this); };
+
+			auto next(this CaptureMatchesRef& self) -> std::optional<std::expected<CapturesRef, Error>>
+			{
+				if (self.last_end > self.subject.size()) {
+					return std::nullopt;
+				}
+				auto res =
+					self.re.find_at_with_options(*self.match_data, self.subject, self.last_end, self.options);
+
+				if (!res) {
+					return std::unexpected(Error(res.error()));
+				}
+				self.options |= PCRE2_NO_UTF_CHECK;
+				if (!*res) {
+					return std::nullopt;
+				}
+
+				auto& m = **res;
+				if (m.start == m.end) {
+					// This is an empty match. To ensure we make progress, start
+					// the next search at the smallest possible starting position
+					// of the next match following this one.
+					self.last_end = self.re.next_start(self.subject, m.end);
+					// Don't accept empty matches immediately following a match.
+					// Just move on to the next match.
+					if (self.last_match && *self.last_match == m.end) {
+						return self.next();
+					}
+				}
+				else {
+					self.last_end = m.end;
+				}
+				self.last_match = m.end;
+				return CapturesRef{
+					self.subject.data(),
+					self.match_data->ovector(),
+					self.re.capture_names_idx.get()
+				};
+			}
+		};
+
+		/// Finds the matches of a regex in a stream that arrives in chunks,
+		/// such as a file read piece by piece or a socket.
+		///
+		/// Every chunk is appended to a buffer and searched with
+		/// `PCRE2_PARTIAL_HARD`. Matches that end before the end of the
+		/// buffer are reported right away. A match that may go on in the next
+		/// chunk is held back, and the buffer keeps everything from where it
+		/// starts. Otherwise the buffer only keeps the few characters that
+		/// lookbehinds (and `\b`) need to look at, so memory stays bounded by
+		/// the longest match in progress rather than the size of the stream.
+		///
+		/// Matches are found as `find_iter` would find them in the whole
+		/// stream, with offsets from the start of the stream, except that
+		/// `^` and `\A` only match at its very start.
+		class StreamMatcher
+		{
+			const basic_regex& re;
+			/// The part of the stream that is still needed.
+			string_type buffer;
+			/// The stream offset of `buffer[0]`.
+			uint64_t base = 0;
+			/// Where in `buffer` the next search starts.
+			size_t next = 0;
+			/// The stream offset where the last match ended.
+			std::optional<uint64_t> last_match;
+			/// How many code units before `next` lookbehinds may look at.
+			size_t lookbehind;
+			/// The most code units a match in progress may hold on to.
+			size_t max_retained;
+
+		public:
+			StreamMatcher(const basic_regex& re, size_t max_retained)
+				: re(re), lookbehind(re.lookbehind_len()), max_retained(max_retained)
+			{
+			}
+
+			/// Searches `chunk`, the next piece of the stream, and calls
+			/// `on_match` with every match that can't change anymore.
+			///
+			/// Fails with `ErrorKind::Limit` if a match in progress would hold
+			/// on to more than `max_retained` code units. The matcher should
+			/// be `reset` after an error.
+			template<typename F>
+				requires std::invocable<F&, StreamMatch>
+			auto feed(this StreamMatcher& self, string_view_type chunk, F&& on_match) -> std::expected<void, Error>
+			{
+				self.buffer.append(chunk);
+				if (auto rc = self.scan(PCRE2_PARTIAL_HARD, on_match); !rc) {
+					return rc;
+				}
+
+				auto keep_from = self.next - std::min(self.next, self.lookbehind);
+				// Lookbehinds can't start in the middle of a character.
+				while (keep_from > 0 && keep_from < self.next && traits<CharT>::is_continuation(self.buffer[keep_from])) {
+					keep_from += 1;
+				}
+				self.buffer.erase(0, keep_from);
+				self.base += keep_from;
+				self.next -= keep_from;
+				if (self.buffer.size() > self.max_retained + self.lookbehind) {
+					return std::unexpected(Error::stream_limit());
+				}
+				return {};
+			}
+
+			/// Ends the stream: reports the matches held back because they
+			/// ran into the end of the buffer, and resets the matcher.
+			template<typename F>
+				requires std::invocable<F&, StreamMatch>
+			auto finish(this StreamMatcher& self, F&& on_match) -> std::expected<void, Error>
+			{
+				auto rc = self.scan(0, on_match);
+				self.reset();
+				return rc;
+			}
+
+			/// Forgets the stream so far. The next chunk starts a new stream.
+			void reset(this StreamMatcher& self) noexcept
+			{
+				self.buffer.clear();
+				self.base = 0;
+				self.next = 0;
+				self.last_match = std::nullopt;
+			}
+
+			/// The number of code units fed so far.
+			auto position(this const StreamMatcher& self) noexcept -> uint64_t
+			{
+				return self.base + self.buffer.size();
+			}
+
+			/// The number of code units the matcher holds on to.
+			auto retained(this const StreamMatcher& self) noexcept -> size_t
+			{
+				return self.buffer.size();
+			}
+
+		private:
+			/// Reports the matches from `next` on. With `PCRE2_PARTIAL_HARD` in
+			/// `partial`, stops at the first match that could still grow and
+			/// leaves `next` at its start.
+			template<typename F>
+			auto scan(this StreamMatcher& self, uint32_t partial, F& on_match) -> std::expected<void, Error>
+			{
+				auto match_data = self.re.match_only_data();
+				auto code = self.re.match_code();
+				string_view_type subject = self.buffer;
+				// PCRE2 rejects a subject that ends in the middle of a
+				// character even when matching partially, so the rest of
+				// it waits for the next chunk.
+				if (partial != 0 && self.re.is_utf()) {
+					subject.remove_suffix(traits<CharT>::incomplete_suffix(subject));
+				}
+				while (self.next <= subject.size()) {
+					auto options = partial;
+					if (self.base > 0) {
+						options |= PCRE2_NOTBOL;
+					}
+					auto found = match_data->find(code, subject, self.next, options);
+					if (!found) {
+						if (found.error().code != PCRE2_ERROR_PARTIAL) {
+							MatchDataLease::put(match_data);
+							return std::unexpected(found.error());
+						}
+						self.next = match_data->ovector()[0];
+						break;
+					}
+					if (!*found) {
+						self.next = subject.size();
+						break;
+					}
+
+					auto start = match_data->ovector()[0];
+					auto end = match_data->ovector()[1];
+					// Such a match is found again once the next chunk shows
+					// whether the newline really ends the stream.
+					if (partial != 0 && self.re.is_final_newline(subject.substr(end))) {
+						self.next = start;
+						break;
+					}
+					if (start == end) {
+						// An empty match at the end might turn out to be
+						// followed by one that isn't empty.
+						if (partial != 0 && end == subject.size()) {
+							self.next = end;
+							break;
+						}
+						self.next = self.re.next_start(subject, end);
+						// Like `find_iter`, skip empty matches right after a
+						// match.
+						if (self.last_match == self.base + end) {
+							continue;
+						}
+					}
+					else {
+						self.next = end;
+					}
+					self.last_match = self.base + end;
+					on_match(StreamMatch{ self.base + start, self.base + end, subject.substr(start, end - start) });
+				}
+				MatchDataLease::put(match_data);
+				return {};
+			}
+		};
+
+		/// Creates a `StreamMatcher` for this regex. A match in progress may
+		/// hold on to at most `max_retained` code units of the stream.
+		///
+		/// The search is JIT compiled for partial matching only with
+		/// `RegexOptions::streaming`.
+		auto stream(this const basic_regex& self, size_t max_retained = static_cast<size_t>(1) << 20) -> StreamMatcher
+		{
+			return StreamMatcher(self, max_retained);
+		}
+
+		/// The matches of a regex in a file, searched in place through a
+		/// `MappedFile`. See `find_iter_file`.
+		///
+		/// The file is searched a window at a time with `PCRE2_PARTIAL_HARD`,
+		/// so no search reads past the end of its window, and a match that
+		/// runs into the end is searched again over a larger one. Pages the
+		/// search has moved past are discarded as it goes, so a scan of a
+		/// large file keeps about one window of it resident, plus whatever
+		/// the longest match needs.
+		///
+		/// Matches hold offsets in code units from the start of the file.
+		/// They point into the mapping, so they are only valid as long as
+		/// the `FileMatches` they came from.
+		struct FileMatches {
+			/// The number of code units searched at a time.
+			static constexpr size_t WINDOW_LEN = (static_cast<size_t>(4) << 20) / sizeof(CharT);
+
+			const basic_regex& re;
+			MappedFile file;
+			MatchDataLease match_data;
+			/// The whole file.
+			string_view_type subject;
+			size_t last_end;
+			std::optional<size_t> last_match;
+			/// Searches don't look past this offset, unless it's the end
+			/// of the file.
+			size_t window_end;
+			/// How far searches have validated the UTF encoding of the
+			/// subject.
+			size_t checked_end;
+			/// How many code units behind `last_end` have to stay mapped.
+			size_t lookbehind;
+
+			struct iterator
+			{
+				using difference_type = std::ptrdiff_t;
+				using element_type = std::expected<Match, Error>;
+				using pointer = element_type*;
+				using reference = const element_type&;
 
-				const element_type& operator*(this const iterator& self)
+				reference& operator*(this const iterator& self)
 				{
 					if (!self.current)
 					{
@@ -530,25 +1654,27 @@ namespace pcre2 {
 					return self.current.value();
 				}
 
-				iterator& operator++(this iterator& self)
+				iterator& operator++()
 				{
-					if (!self.current)
+					if (!current)
 					{
 						throw "at the end";
 					}
 
-					if (auto v = self.matches->next()) {
-						self.current = std::move(v);
+					if (const auto& v = matches->next()) {
+						current = *v;
 					}
 					else {
-						self.current = std::nullopt;
+						current = std::nullopt;
 					}
 
-					++self.index;
+					++index;
 
-					return self;
+					return *this;
 				}
 
+				void operator++(int) { ++*this; }
+
 				bool operator==(const iterator& iter)
 				{
 					if (!iter.current && !current) return true;
@@ -563,185 +1689,656 @@ namespace pcre2 {
 					return iter.matches != matches || iter.index != index;
 				}
 
-				iterator(CaptureMatches* matches,
-					std::optional<std::expected<Captures, Error>>&& start)
-					noexcept : matches(matches), current(std::move(start)), index(0)
+				iterator(FileMatches* matches,
+					std::optional<std::expected<Match, Error>>&& start) noexcept : matches(matches), index(0)
 				{
-
+					if (const auto& v = start)
+					{
+						current = *v;
+					}
 				}
 
-				iterator(CaptureMatches* matches) noexcept : matches(matches), index(-1) {}
+				iterator(FileMatches* matches) noexcept : matches(matches), index(-1) {}
+
+				iterator(const iterator& iter) noexcept : matches(iter.matches), index(iter.index)
+				{
+					if (const auto& v = iter.current)
+					{
+						current = *v;
+					}
+				}
 
 				~iterator() = default;
 
 			private:
-				CaptureMatches* matches;
-				std::optional<std::expected<Captures, Error>> current;
+				FileMatches* matches;
+				std::optional<std::expected<Match, Error>> current;
 				int index;
 			};
 
+			static_assert(std::input_iterator<iterator>);
+
 			auto begin() { return iterator(this, next()); };
 
 			auto end() { return iterator(this); };
 
-			auto next(this CaptureMatches& self) -> std::optional<std::expected<Captures, Error>>
+			auto next(this FileMatches& self) -> std::optional<std::expected<Match, Error>>
 			{
-				if (self.last_end > self.subject.size()) {
-					return std::nullopt;
-				}
-				auto locs = self.re.capture_locations();
-				auto res =
-					self.re.captures_read_at(locs, self.subject, self.last_end);
+				auto code = self.re.match_code();
+				while (self.last_end <= self.subject.size()) {
+					auto last = self.window_end >= self.subject.size();
+					auto window = self.subject.substr(0, self.window_end);
+					uint32_t options = 0;
+					if (!last) {
+						options |= PCRE2_PARTIAL_HARD;
+						// PCRE2 rejects a subject that ends in the middle of
+						// a character even when matching partially.
+						if (self.re.is_utf()) {
+							window.remove_suffix(traits<CharT>::incomplete_suffix(window));
+						}
+					}
+					// PCRE2 validates everything from the start offset on, so
+					// only a window that grew needs to be checked again.
+					if (window.size() <= self.checked_end) {
+						options |= PCRE2_NO_UTF_CHECK;
+					}
 
-				if (!res) {
-					return std::unexpected(Error(res.error()));
+					auto found = self.match_data->find(code, window, self.last_end, options);
+					if (!found && found.error().code != PCRE2_ERROR_PARTIAL) {
+						return std::unexpected(found.error());
+					}
+					self.checked_end = std::max(self.checked_end, window.size());
+					if (!found) {
+						// A match runs into the end of the window. Search again
+						// from where it starts.
+						self.last_end = self.match_data->ovector()[0];
+						self.grow();
+						continue;
+					}
+					if (!*found) {
+						if (last) {
+							self.last_end = self.subject.size() + 1;
+							return std::nullopt;
+						}
+						self.last_end = window.size();
+						self.window_end = self.last_end + WINDOW_LEN;
+						self.discard();
+						continue;
+					}
+
+					auto start = self.match_data->ovector()[0];
+					auto end = self.match_data->ovector()[1];
+					// A match before a final newline, or an empty one at the
+					// end, may turn out differently once the window grows.
+					if (!last && (self.re.is_final_newline(window.substr(end)) || (start == end && end == window.size()))) {
+						self.last_end = start;
+						self.grow();
+						continue;
+					}
+					if (start == end) {
+						self.last_end = self.re.next_start(window, end);
+						// Like `find_iter`, skip empty matches right after a
+						// match.
+						if (self.last_match == end) {
+							continue;
+						}
+					}
+					else {
+						self.last_end = end;
+					}
+					self.last_match = end;
+					self.discard();
+					return Match{ self.subject.data(), start, end };
 				}
-				else if (!*res) {
-					return std::nullopt;
+				return std::nullopt;
+			}
+
+		private:
+			/// Grows the window by as much as is left of it, so that a long
+			/// match is searched a logarithmic number of times.
+			void grow(this FileMatches& self) noexcept
+			{
+				self.window_end += std::max(WINDOW_LEN, self.window_end - self.last_end);
+			}
+
+			/// Discards the pages before what the next search may look at,
+			/// a window's worth at a time.
+			void discard(this FileMatches& self) noexcept
+			{
+				auto keep_from = self.last_end - std::min(self.last_end, self.lookbehind);
+				self.file.discard_before(keep_from * sizeof(CharT), WINDOW_LEN * sizeof(CharT));
+			}
+		};
+
+		/// Searches the file at `path` for successive non-overlapping
+		/// matches, like `find_iter` does over a string. The file is mapped
+		/// rather than read and its contents are taken as code units of
+		/// `CharT` in the byte order of the machine, so a `wregex` expects
+		/// UTF-16 on Windows and UTF-32 elsewhere. Fails with
+		/// `ErrorKind::Io` if the file can't be mapped.
+		///
+		/// The search is JIT compiled for the partial matching it needs only
+		/// with `RegexOptions::streaming`.
+		auto find_iter_file(this const basic_regex& self, const std::filesystem::path& path)
+			-> std::expected<FileMatches, Error>
+		{
+			auto file = MappedFile::open(path);
+			if (!file) {
+				return std::unexpected(file.error());
+			}
+			auto subject = file->template units<CharT>();
+			return FileMatches{
+				 .re = self,
+				 .file = std::move(*file),
+				 .match_data = self.match_only_data(),
+				 .subject = subject,
+				 .last_end = 0,
+				 .last_match = std::nullopt,
+				 .window_end = FileMatches::WINDOW_LEN,
+				 .checked_end = 0,
+				 .lookbehind = self.lookbehind_len(),
+			};
+		}
+
+		/// Counts the matches `find_iter_file` finds in the file at `path`.
+		auto count_file(this const basic_regex& self, const std::filesystem::path& path)
+			-> std::expected<size_t, Error>
+		{
+			auto matches = self.find_iter_file(path);
+			if (!matches) {
+				return std::unexpected(matches.error());
+			}
+			size_t count = 0;
+			while (auto m = matches->next()) {
+				if (!*m) {
+					return std::unexpected(m->error());
 				}
+				count++;
+			}
+			return count;
+		}
 
-				auto& m = **res;
-				if (m.start == m.end) {
-					// This is an empty match. To ensure we make progress, start
-					// the next search at the smallest possible starting position
-					// of the next match following this one.
-					self.last_end = m.end + 1;
-					// Don't accept empty matches immediately following a match.
-					// Just move on to the next match.
-					if (self.last_match && *self.last_match == m.end) {
-						return self.next();
-					}
+		/// Collects the matches `find_iter` finds in `subject`, searching
+		/// chunks of it on up to `threads` threads at once, or one per
+		/// hardware thread if `threads` is 0. Chunks are at least
+		/// `PAR_MIN_CHUNK_LEN` long, so short subjects are searched on the
+		/// calling thread.
+		///
+		/// Every thread borrows its own match data and walks its chunk like
+		/// `find_iter` would, from the start of the chunk up to the first
+		/// match that starts past its end. Searches still run over the whole
+		/// subject, so lookbehinds and `\b` see the text before the chunk.
+		/// Where the next match is found also depends on where the last one
+		/// ended, though, so a chunk's matches are only taken from where
+		/// the walk through the previous chunks reaches one of its positions
+		/// right after the same match. Until then the walk searches on by
+		/// itself, which is usually a single search. The result is the same
+		/// as collecting `find_iter(subject)`, errors included.
+		auto par_find_all(this const basic_regex& self, string_view_type subject, size_t threads = 0)
+			-> std::expected<std::vector<Match>, Error>
+		{
+			if (threads == 0) {
+				threads = std::max(1u, std::thread::hardware_concurrency());
+			}
+			auto chunks = std::min(threads, subject.size() / PAR_MIN_CHUNK_LEN);
+			uint32_t options = 0;
+			if (self.config.utf && !self.config.ucp) {
+				// Validate the subject once rather than on every thread. An
+				// invalid one is left to a single walk to report.
+				if (traits<CharT>::valid_utf(subject)) {
+					options |= PCRE2_NO_UTF_CHECK;
 				}
 				else {
-					self.last_end = m.end;
+					chunks = 1;
 				}
-				self.last_match = m.end;
-				return Captures{
-					self.subject.data(),
-					std::move(locs),
-					self.re.capture_names_idx.get()
+			}
+			auto walk_from = [&](size_t start) {
+				return Matches{
+					 .re = self,
+					 .match_data = self.match_only_data(),
+					 .subject = subject,
+					 .last_end = start,
+					 .last_match = std::nullopt,
+					 .options = options,
 				};
+			};
+
+			std::vector<Match> all;
+			if (chunks <= 1) {
+				auto matches = walk_from(0);
+				while (auto m = matches.next()) {
+					if (!*m) {
+						return std::unexpected(m->error());
+					}
+					all.push_back(**m);
+				}
+				return all;
 			}
-		};
 
-		auto find_at(this const wregex& self,
-			std::wstring_view subject,
+			std::vector<size_t> bounds(chunks + 1, subject.size());
+			for (size_t c = 1; c < chunks; c++) {
+				auto at = subject.size() / chunks * c;
+				// NO_UTF_CHECK requires searches to start on a character.
+				while (self.is_utf() && at < subject.size() && traits<CharT>::is_continuation(subject[at])) {
+					at += 1;
+				}
+				bounds[c] = at;
+			}
+			bounds[0] = 0;
+
+			std::vector<ChunkMatches> found(chunks);
+			auto walk_chunk = [&](size_t c) {
+				auto& out = found[c];
+				auto matches = walk_from(bounds[c]);
+				while (true) {
+					auto m = matches.next();
+					if (!m) {
+						out.finished = true;
+						break;
+					}
+					if (!*m) {
+						out.error = m->error();
+						break;
+					}
+					out.matches.push_back(**m);
+					out.next_starts.push_back(matches.last_end);
+					if ((*m)->start >= bounds[c + 1] && c + 1 < chunks) {
+						break;
+					}
+				}
+			};
+			{
+				std::vector<std::jthread> workers;
+				workers.reserve(chunks - 1);
+				for (size_t c = 1; c < chunks; c++) {
+					workers.emplace_back(walk_chunk, c);
+				}
+				walk_chunk(0);
+			}
+
+			size_t total = 0;
+			for (const auto& chunk : found) {
+				total += chunk.matches.size();
+			}
+			all.reserve(total);
+
+			// Stitch the chunks together, walking on from the previous chunk
+			// until its state agrees with the next one.
+			auto walk = walk_from(0);
+			size_t c = 0;
+			while (true) {
+				// A chunk the walk has moved past can't agree with it anymore.
+				while (c < chunks && walk.last_end > (found[c].next_starts.empty() ? bounds[c] : found[c].next_starts.back())) {
+					c++;
+				}
+				if (c < chunks) {
+					const auto& chunk = found[c];
+					std::optional<size_t> from;
+					if (walk.last_end == bounds[c] && !walk.last_match) {
+						from = 0;
+					}
+					else {
+						auto it = std::lower_bound(chunk.next_starts.begin(), chunk.next_starts.end(), walk.last_end);
+						auto j = static_cast<size_t>(it - chunk.next_starts.begin());
+						if (it != chunk.next_starts.end() && *it == walk.last_end && walk.last_match == chunk.matches[j].end) {
+							from = j + 1;
+						}
+					}
+					if (from) {
+						all.insert(all.end(), chunk.matches.begin() + *from, chunk.matches.end());
+						if (*from < chunk.matches.size()) {
+							walk.last_end = chunk.next_starts.back();
+							walk.last_match = chunk.matches.back().end;
+						}
+						if (chunk.error) {
+							return std::unexpected(*chunk.error);
+						}
+						if (chunk.finished) {
+							return all;
+						}
+						c++;
+						continue;
+					}
+				}
+				auto m = walk.next();
+				if (!m) {
+					return all;
+				}
+				if (!*m) {
+					return std::unexpected(m->error());
+				}
+				all.push_back(**m);
+			}
+		}
+
+		/// Sets `out[i]` to whether `subjects[i]` matches, for every subject,
+		/// searching on up to `threads` threads, or one per hardware thread
+		/// if `threads` is 0. `out` must be at least as long as `subjects`.
+		///
+		/// The subjects are shared out with a `WorkQueue`, and every thread
+		/// borrows match data once for all the subjects it takes rather than
+		/// once per subject. Small batches are searched on the calling
+		/// thread. If searches fail, the others still run and the error of
+		/// the first subject that failed is returned; its `out` entry is 0.
+		auto is_match_batch(
+			this const basic_regex& self,
+			std::span<const string_view_type> subjects,
+			std::span<uint8_t> out,
+			size_t threads = 0
+		) -> std::expected<void, Error> {
+			assert(out.size() >= subjects.size(), "out ({}) is shorter than subjects ({})", out.size(), subjects.size());
+			return self.run_batch(subjects.size(), threads, [&](const MatchData& match_data, size_t i) {
+				auto found = self.is_match_at_with_options(&match_data, subjects[i], 0, 0);
+				out[i] = found.value_or(false);
+				return found.transform([](bool) {});
+				});
+		}
+
+		/// Sets `out[i]` to the first match in `subjects[i]`, for every
+		/// subject. Works like `is_match_batch` otherwise; the entry of a
+		/// subject whose search failed is `nullopt`.
+		auto find_batch(
+			this const basic_regex& self,
+			std::span<const string_view_type> subjects,
+			std::span<std::optional<Match>> out,
+			size_t threads = 0
+		) -> std::expected<void, Error> {
+			assert(out.size() >= subjects.size(), "out ({}) is shorter than subjects ({})", out.size(), subjects.size());
+			return self.run_batch(subjects.size(), threads, [&](const MatchData& match_data, size_t i) {
+				auto found = self.find_at_with_literal(match_data, subjects[i], 0, 0);
+				out[i] = found.value_or(std::nullopt);
+				return found.transform([](const auto&) {});
+				});
+		}
+
+		auto find_at(this const basic_regex& self,
+			string_view_type subject,
 			size_t start
 		) -> std::expected<std::optional<Match>, Error> {
-			auto match_data = self.match_data.get();
-			auto res =
-				self.find_at_with_match_data(match_data, subject, start);
-			MatchDataPoolGuard::put(match_data);
-			return res;
+			return self.find_at_with_pool(subject, start, 0);
+		}
+
+		/// Like `find_at`, but skips UTF validation of the subject.
+		auto find_at(this const basic_regex& self,
+			trusted_utf<CharT> subject,
+			size_t start
+		) -> std::expected<std::optional<Match>, Error> {
+			return self.find_at_with_pool(subject.subject, start, PCRE2_NO_UTF_CHECK);
+		}
+
+		/// Like `find_at`, but searches with the caller's scratch space
+		/// instead of match data from the pool.
+		auto find_at(this const basic_regex& self,
+			Scratch& scratch,
+			string_view_type subject,
+			size_t start
+		) -> std::expected<std::optional<Match>, Error> {
+			assert(scratch.code == self.code.get(), "scratch space belongs to another regex");
+			return self.find_at_with_literal(*scratch.data, subject, start, 0);
+		}
+
+		/// Like `find_at`, but fails with `ErrorKind::Timeout` once `deadline`
+		/// has passed. See `RegexOptions::interruptible`.
+		auto find_at(this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			std::chrono::steady_clock::time_point deadline
+		) -> std::expected<std::optional<Match>, Error> {
+			return self.find_at_with_interrupt(subject, start, Interrupt{ deadline });
+		}
+
+		/// Like `find_at`, but fails with `ErrorKind::Cancelled` once `token`
+		/// is cancelled. See `RegexOptions::interruptible`.
+		auto find_at(this const basic_regex& self,
+			string_view_type subject,
+			size_t start,
+			const CancellationToken& token
+		) -> std::expected<std::optional<Match>, Error> {
+			return self.find_at_with_interrupt(subject, start, Interrupt{ std::nullopt, &token });
 		}
 
 		inline auto captures_read(
-			this const wregex& self,
+			this const basic_regex& self,
 			CaptureLocations& locs,
-			std::wstring_view subject
+			string_view_type subject
 		) -> std::expected<std::optional<Match>, Error>
 		{
 			return self.captures_read_at(locs, subject, 0);
 		}
 
-		inline auto is_match(this const wregex& self, std::wstring_view subject) -> std::expected<bool, Error>
+		inline auto is_match(this const basic_regex& self, string_view_type subject) -> std::expected<bool, Error>
+		{
+			return self.is_match_at(subject, 0);
+		}
+
+		inline auto is_match(this const basic_regex& self, trusted_utf<CharT> subject) -> std::expected<bool, Error>
 		{
 			return self.is_match_at(subject, 0);
 		}
 
+		inline auto is_match(this const basic_regex& self, Scratch& scratch, string_view_type subject) -> std::expected<bool, Error>
+		{
+			return self.is_match_at(scratch, subject, 0);
+		}
+
+		inline auto find(
+			this const basic_regex& self,
+			string_view_type subject
+		) -> std::expected<std::optional<Match>, Error> {
+			return self.find_at(subject, 0);
+		}
+
 		inline auto find(
-			this const wregex& self,
-			std::wstring_view subject
+			this const basic_regex& self,
+			trusted_utf<CharT> subject
 		) -> std::expected<std::optional<Match>, Error> {
 			return self.find_at(subject, 0);
 		}
 
-		inline auto find_iter(this const wregex& self, std::wstring_view subject) -> Matches
+		inline auto find_iter(this const basic_regex& self, string_view_type subject) -> Matches
+		{
+			return Matches{
+				 .re = self,
+				 .match_data = self.match_only_data(),
+				 .subject = subject,
+				 .last_end = 0,
+				 .last_match = std::nullopt,
+				 .options = 0,
+			};
+		}
+
+		/// Like `find_iter`, but skips UTF validation of the subject.
+		inline auto find_iter(this const basic_regex& self, trusted_utf<CharT> subject) -> Matches
+		{
+			return Matches{
+				 .re = self,
+				 .match_data = self.match_only_data(),
+				 .subject = subject.subject,
+				 .last_end = 0,
+				 .last_match = std::nullopt,
+				 .options = PCRE2_NO_UTF_CHECK,
+			};
+		}
+
+		/// Like `find_iter`, but searches with the caller's scratch space
+		/// instead of match data from the pool.
+		inline auto find_iter(this const basic_regex& self, Scratch& scratch, string_view_type subject) -> Matches
 		{
+			assert(scratch.code == self.code.get(), "scratch space belongs to another regex");
 			return Matches{
 				 .re = self,
-				 .match_data = self.match_data.get(),
+				 .match_data = MatchDataLease{ std::nullopt, {}, scratch.data.get() },
 				 .subject = subject,
 				 .last_end = 0,
 				 .last_match = std::nullopt,
+				 .options = 0,
 			};
 		}
 
 		auto captures(
-			this const wregex& self,
-			std::wstring_view subject
+			this const basic_regex& self,
+			string_view_type subject
 		) -> std::expected<std::optional<Captures>, Error> {
 			auto locs = self.capture_locations();
-			return self.captures_read(locs, subject)->transform(
-				[&](auto&)
+			return self.captures_read(locs, subject).transform(
+				[&](auto found)
 				{
-					return Captures(subject.data(), std::move(locs), self.capture_names_idx.get());
+					return found.transform([&](auto&)
+						{
+							return Captures(subject.data(), std::move(locs), self.capture_names_idx.get());
+						});
 				});
 		}
 
 		auto captures_iter(
-			this const wregex& self,
-			std::wstring_view subject
+			this const basic_regex& self,
+			string_view_type subject
+		) -> CaptureMatches {
+			return CaptureMatches{ .re = self, .subject = subject, .last_end = 0, .last_match = std::nullopt, .options = 0 };
+		}
+
+		/// Like `captures_iter`, but skips UTF validation of the subject.
+		auto captures_iter(
+			this const basic_regex& self,
+			trusted_utf<CharT> subject
 		) -> CaptureMatches {
-			return CaptureMatches{ .re = self, .subject = subject, .last_end = 0, .last_match = std::nullopt };
+			return CaptureMatches{ .re = self, .subject = subject.subject, .last_end = 0, .last_match = std::nullopt, .options = PCRE2_NO_UTF_CHECK };
+		}
+
+		/// Like `captures_iter`, but borrows one `MatchData` for the whole
+		/// iteration and yields `CapturesRef` views of it, which are only
+		/// valid until the next step. Use `to_owned` to keep one.
+		auto captures_iter_ref(
+			this const basic_regex& self,
+			string_view_type subject
+		) -> CaptureMatchesRef {
+			return CaptureMatchesRef{
+				.re = self,
+				.match_data = self.borrow(),
+				.subject = subject,
+				.last_end = 0,
+				.last_match = std::nullopt,
+				.options = 0,
+			};
+		}
+
+		/// Like `captures_iter_ref`, but skips UTF validation of the subject.
+		auto captures_iter_ref(
+			this const basic_regex& self,
+			trusted_utf<CharT> subject
+		) -> CaptureMatchesRef {
+			return CaptureMatchesRef{
+				.re = self,
+				.match_data = self.borrow(),
+				.subject = subject.subject,
+				.last_end = 0,
+				.last_match = std::nullopt,
+				.options = PCRE2_NO_UTF_CHECK,
+			};
 		}
 
 		auto substitute_with_options(
-			this const wregex& self,
-			std::wstring_view subject,
-			std::wstring_view replacement,
+			this const basic_regex& self,
+			string_view_type subject,
+			string_view_type replacement,
 			uint32_t options,
-			std::wstring& output) noexcept -> bool {
-			PCRE2_SPTR16 subject_ptr = reinterpret_cast<const PCRE2_UCHAR16*>(subject.data());
-			PCRE2_SPTR16 replacement_ptr = reinterpret_cast<const PCRE2_UCHAR16*>(replacement.data());
-			//pcre2_callout_enumerate_16
-			if (output.size() < subject.size()) output.resize(subject.size() + 1);
-			size_t outlen = output.size();
+			string_type& output) noexcept -> bool {
+			// How much longer than the subject the output of the last
+			// substitution on this thread needed to be, in eighths of the
+			// subject length beyond a small fixed slack. Sizing the output
+			// from this up front makes PCRE2_ERROR_NOMEMORY retries rare for
+			// runs of similar substitutions. It is clamped to `max_growth`, so
+			// a short subject that grew a lot can't make the next, longer one
+			// reserve many times its length.
+			static thread_local size_t growth = 0;
+			static constexpr size_t slack = 16;
+			static constexpr size_t max_growth = 16;
+
+			if (auto done = self.substitute_literal(subject, replacement, options, output)) {
+				return *done;
+			}
 
-			auto match_data = self.new_match_data();
+			auto find_options = options & PCRE2_NO_UTF_CHECK;
+			auto at = self.prefilter_at(subject, 0, find_options);
+			if (!at) {
+				return false;
+			}
 
-			auto c = match_data->find(self.code.get(), subject, 0, 0);
-			if (!c || !*c) return false;
+			auto match_data = self.borrow();
 
-			int rc = pcre2_substitute_16(
-				self.code->as_ptr(),
-				subject_ptr,
-				subject.size(),
-				0,
-				options | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH,
-				match_data->as_mut_ptr(),
-				nullptr,
-				replacement_ptr,
-				replacement.size(),
-				reinterpret_cast<PCRE2_UCHAR16*>(output.data()),
-				&outlen);
-			if (rc >= 0) {
-				output.resize(outlen);
-				return true;
+			// The initial search validates the subject, so none of the
+			// substitution calls below need to do it again. PCRE2 would also
+			// check the replacement on those calls, so do that once here.
+			auto c = match_data->find_backtracking(self.code.get(), subject, *at, find_options);
+			if (!c || !*c) return false;
+			if (self.is_utf()
+				&& (options & PCRE2_NO_UTF_CHECK) == 0
+				&& !traits<CharT>::valid_utf(replacement)) {
+				return false;
 			}
-			else if (rc == PCRE2_ERROR_NOMEMORY)
+			options |= PCRE2_NO_UTF_CHECK;
+
+			int rc = 0;
+			size_t capacity = subject.size() + subject.size() * growth / 8 + slack;
+			size_t outlen = 0;
+			output.resize_and_overwrite(
+				capacity,
+				[&](CharT* buffer, size_t) -> size_t {
+					// PCRE2 always writes a trailing NUL, which may go in
+					// buffer[capacity].
+					outlen = capacity + 1;
+					// The search above left its match in the match data, so
+					// PCRE2_SUBSTITUTE_MATCHED lets PCRE2 start from it instead
+					// of matching again.
+					rc = traits<CharT>::substitute(
+						self.code->as_ptr(),
+						subject,
+						0,
+						options | PCRE2_SUBSTITUTE_MATCHED | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH,
+						match_data->as_mut_ptr(),
+						match_data->match_context,
+						replacement,
+						buffer,
+						&outlen);
+					return rc >= 0 ? outlen : 0;
+				});
+
+			if (rc == PCRE2_ERROR_NOMEMORY)
 			{
-				output.resize(outlen);
+				// `outlen` is now the exact length needed, including the NUL.
+				// The match data holds the last match of that attempt rather
+				// than the first, so this time PCRE2 has to match from scratch.
+				capacity = outlen - 1;
+				output.resize_and_overwrite(
+					capacity,
+					[&](CharT* buffer, size_t) -> size_t {
+						outlen = capacity + 1;
+						rc = traits<CharT>::substitute(
+							self.code->as_ptr(),
+							subject,
+							0,
+							options & ~PCRE2_SUBSTITUTE_MATCHED,
+							match_data->as_mut_ptr(),
+							match_data->match_context,
+							replacement,
+							buffer,
+							&outlen);
+						return rc >= 0 ? outlen : 0;
+					});
+			}
 
-				rc = pcre2_substitute_16(self.code->as_ptr(),
-					subject_ptr,
-					subject.size(),
-					0,
-					options,        
-					match_data->as_mut_ptr(),
-					nullptr,
-					replacement_ptr,  
-					replacement.size(),
-					reinterpret_cast<PCRE2_UCHAR16*>(output.data()),
-					&outlen);
+			MatchDataLease::put(match_data);
 
-				if (rc >= 0) {
-					output.resize(outlen);
-					return true;
-				}
+			if (rc < 0) {
+				return false;
 			}
 
-			return false;
+			size_t needed = 0;
+			if (auto extra = output.size() - std::min(output.size(), subject.size()); extra > slack) {
+				needed = ((extra - slack) * 8 + subject.size() - 1) / std::max<size_t>(subject.size(), 1);
+			}
+			growth = std::min(needed, max_growth);
+			return true;
 		}
 
 		static constexpr uint32_t SUBSTITUTE_MATCHED =
@@ -750,10 +2347,10 @@ namespace pcre2 {
 			| PCRE2_SUBSTITUTE_UNKNOWN_UNSET
 			| PCRE2_SUBSTITUTE_UNSET_EMPTY;
 
-		auto substitute(this const wregex& self,
-			std::wstring_view subject,
-			std::wstring_view replacement, 
-			std::wstring& output) -> bool {
+		auto substitute(this const basic_regex& self,
+			string_view_type subject,
+			string_view_type replacement, 
+			string_type& output) -> bool {
 			return self.substitute_with_options(
 				subject, 
 				replacement, 
@@ -761,10 +2358,10 @@ namespace pcre2 {
 				output);
 		}
 
-		auto substitute_all(this const wregex& self,
-			std::wstring_view subject,
-			std::wstring_view replacement,
-			std::wstring& output) -> bool {
+		auto substitute_all(this const basic_regex& self,
+			string_view_type subject,
+			string_view_type replacement,
+			string_type& output) -> bool {
 
 			return self.substitute_with_options(
 				subject,
@@ -773,6 +2370,134 @@ namespace pcre2 {
 				output);
 		}
 
+		/// Like `substitute`, but skips UTF validation of the subject and the
+		/// replacement.
+		auto substitute(this const basic_regex& self,
+			trusted_utf<CharT> subject,
+			string_view_type replacement,
+			string_type& output) -> bool {
+			return self.substitute_with_options(
+				subject.subject,
+				replacement,
+				SUBSTITUTE_MATCHED | PCRE2_NO_UTF_CHECK,
+				output);
+		}
+
+		/// Like `substitute_all`, but skips UTF validation of the subject and
+		/// the replacement.
+		auto substitute_all(this const basic_regex& self,
+			trusted_utf<CharT> subject,
+			string_view_type replacement,
+			string_type& output) -> bool {
+			return self.substitute_with_options(
+				subject.subject,
+				replacement,
+				SUBSTITUTE_MATCHED | PCRE2_SUBSTITUTE_GLOBAL | PCRE2_NO_UTF_CHECK,
+				output);
+		}
+
+		/// Parses a replacement template once so it can be expanded many times
+		/// without going through `pcre2_substitute`. Group names are resolved
+		/// against this regex, so the result should only be used with it.
+		auto compile_replacement(
+			this const basic_regex& self,
+			string_view_type replacement
+		) -> std::expected<Replacement, Error> {
+			return Replacement::compile(replacement, self.captures_len(), *self.capture_names_idx);
+		}
+
+		/// Like `substitute`, but expands a precompiled replacement. Fails if
+		/// the search does.
+		auto substitute(this const basic_regex& self,
+			string_view_type subject,
+			const Replacement& replacement,
+			string_type& output) -> std::expected<bool, Error> {
+			return self.substitute_with_replacement(subject, replacement, 1, output);
+		}
+
+		/// Like `substitute_all`, but expands a precompiled replacement. Fails
+		/// if a search does.
+		auto substitute_all(this const basic_regex& self,
+			string_view_type subject,
+			const Replacement& replacement,
+			string_type& output) -> std::expected<bool, Error> {
+			return self.substitute_with_replacement(subject, replacement, 0, output);
+		}
+
+		/// Replaces at most `limit` non-overlapping matches in `subject`,
+		/// writing the result to `out`. A `limit` of 0 replaces every match.
+		///
+		/// Unlike `substitute`, this never goes through `pcre2_substitute`.
+		/// The text between matches is copied straight to `out` and the
+		/// replacement for each match is produced by `replacer`, which is
+		/// either a `Replacer` or a callback (see `replace_append`). So the
+		/// output can be any sink, such as a `std::back_inserter` or an
+		/// `std::ostreambuf_iterator`, and no size has to be guessed up front.
+		template<typename OutputIt, typename R>
+		auto replacen(
+			this const basic_regex& self,
+			string_view_type subject,
+			size_t limit,
+			OutputIt out,
+			R&& replacer
+		) -> std::expected<OutputIt, Error> {
+			size_t last = 0;
+			size_t count = 0;
+			auto it = self.captures_iter_ref(subject);
+			while (auto caps = it.next()) {
+				if (!*caps) {
+					return std::unexpected(caps->error());
+				}
+				auto m = (*caps)->get(0).value();
+				out = std::copy(subject.begin() + last, subject.begin() + m.start, out);
+				out = replace_append<CharT>(replacer, **caps, out);
+				last = m.end;
+				count += 1;
+				if (count == limit) {
+					break;
+				}
+			}
+			return std::copy(subject.begin() + last, subject.end(), out);
+		}
+
+		/// Replaces the leftmost match in `subject`, writing the result to
+		/// `out`. See `replacen`.
+		template<typename OutputIt, typename R>
+		inline auto replace(
+			this const basic_regex& self,
+			string_view_type subject,
+			OutputIt out,
+			R&& replacer
+		) -> std::expected<OutputIt, Error> {
+			return self.replacen(subject, 1, out, std::forward<R>(replacer));
+		}
+
+		/// Replaces every non-overlapping match in `subject`, writing the
+		/// result to `out`. See `replacen`.
+		template<typename OutputIt, typename R>
+		inline auto replace_all(
+			this const basic_regex& self,
+			string_view_type subject,
+			OutputIt out,
+			R&& replacer
+		) -> std::expected<OutputIt, Error> {
+			return self.replacen(subject, 0, out, std::forward<R>(replacer));
+		}
+
+		/// Replaces every non-overlapping match in `subject` and returns the
+		/// result as a new string.
+		template<typename R>
+		auto replace_all(
+			this const basic_regex& self,
+			string_view_type subject,
+			R&& replacer
+		) -> std::expected<string_type, Error> {
+			string_type output;
+			output.reserve(subject.size());
+			return self.replacen(subject, 0, std::back_inserter(output), std::forward<R>(replacer))
+				.transform([&](auto) { return std::move(output); });
+		}
+
 		struct Split {
 			Matches finder;
 			size_t last;
@@ -780,7 +2505,7 @@ namespace pcre2 {
 			struct iterator
 			{
 				using difference_type = std::ptrdiff_t;
-				using element_type = std::expected<std::wstring_view, Error>;
+				using element_type = std::expected<string_view_type, Error>;
 				using pointer = element_type*;
 				using reference = element_type&;
 
@@ -827,7 +2552,7 @@ namespace pcre2 {
 				}
 
 				iterator(Split* split,
-					std::optional<std::expected<std::wstring_view, Error>> start)
+					std::optional<std::expected<string_view_type, Error>> start)
 					noexcept : split(split), current(start), index(0)
 				{
 
@@ -839,7 +2564,7 @@ namespace pcre2 {
 
 			private:
 				Split* split;
-				std::optional<std::expected<std::wstring_view, Error>> current;
+				std::optional<std::expected<string_view_type, Error>> current;
 				int index;
 			};
 
@@ -847,7 +2572,7 @@ namespace pcre2 {
 
 			auto end() { return iterator(this); };
 
-			auto next(this Split& self) -> std::optional<std::expected<std::wstring_view, Error>> {
+			auto next(this Split& self) -> std::optional<std::expected<string_view_type, Error>> {
 				auto text = self.finder.subject;
 				auto v = self.finder.next();
 				if (!v)
@@ -874,7 +2599,12 @@ namespace pcre2 {
 			}
 		};
 
-		inline auto split(this const wregex& self, std::wstring_view haystack) noexcept -> Split
+		inline auto split(this const basic_regex& self, string_view_type haystack) noexcept -> Split
+		{
+			return Split{ .finder = self.find_iter(haystack), .last = 0 };
+		}
+
+		inline auto split(this const basic_regex& self, trusted_utf<CharT> haystack) noexcept -> Split
 		{
 			return Split{ .finder = self.find_iter(haystack), .last = 0 };
 		}
@@ -886,7 +2616,7 @@ namespace pcre2 {
 			struct iterator
 			{
 				using difference_type = std::ptrdiff_t;
-				using element_type = std::expected<std::wstring_view, Error>;
+				using element_type = std::expected<string_view_type, Error>;
 				using pointer = element_type*;
 				using reference = element_type&;
 
@@ -933,7 +2663,7 @@ namespace pcre2 {
 				}
 
 				iterator(SplitN* split,
-					std::optional<std::expected<std::wstring_view, Error>> start)
+					std::optional<std::expected<string_view_type, Error>> start)
 					noexcept : split(split), current(start), index(0)
 				{
 
@@ -945,7 +2675,7 @@ namespace pcre2 {
 
 			private:
 				SplitN* split;
-				std::optional<std::expected<std::wstring_view, Error>> current;
+				std::optional<std::expected<string_view_type, Error>> current;
 				int index;
 			};
 
@@ -953,7 +2683,7 @@ namespace pcre2 {
 
 			auto end() noexcept { return iterator(this); };
 
-			auto next(this SplitN& self) -> std::optional<std::expected<std::wstring_view, Error>>
+			auto next(this SplitN& self) -> std::optional<std::expected<string_view_type, Error>>
 			{
 				if (self.limit == 0) {
 					return std::nullopt;
@@ -983,12 +2713,31 @@ namespace pcre2 {
 		};
 
 		inline auto splitn(
-			this const wregex& self,
-			std::wstring_view haystack,
+			this const basic_regex& self,
+			string_view_type haystack,
+			size_t limit
+		) noexcept -> SplitN
+		{
+			return SplitN{ Split{.finder = self.find_iter(haystack), .last = 0 }, limit };
+		}
+
+		inline auto splitn(
+			this const basic_regex& self,
+			trusted_utf<CharT> haystack,
 			size_t limit
 		) noexcept -> SplitN
 		{
 			return SplitN{ Split{.finder = self.find_iter(haystack), .last = 0 }, limit };
 		}
 	};
+
+	/// A regex over narrow strings. PCRE2 treats these as UTF-8 when `utf` is
+	/// enabled.
+	using regex = basic_regex<char>;
+	using u8regex = basic_regex<char8_t>;
+	/// A regex over wide strings. This is UTF-16 on Windows and UTF-32
+	/// elsewhere.
+	using wregex = basic_regex<wchar_t>;
+	using u16regex = basic_regex<char16_t>;
+	using u32regex = basic_regex<char32_t>;
 }
\ No newline at end of file
@@ -60,6 +60,24 @@ namespace pcre2 {
 			return self;
 		}
 
+		/// Treat the pattern as a fixed string rather than a regular
+		/// expression.
+		RegexOptions& literal(this auto& self, bool yes)
+		{
+			self.config.literal = yes;
+			return self;
+		}
+
+		/// Compile a second copy of the pattern without capture groups, used
+		/// by `is_match`, `find` and `find_iter`. PCRE2 does less work per
+		/// match when it doesn't have to track groups. This doubles compile
+		/// time and memory, and is skipped for patterns it can't apply to.
+		RegexOptions& captureless(this auto& self, bool yes)
+		{
+			self.config.captureless = yes;
+			return self;
+		}
+
 		RegexOptions& jit(this auto& self, bool yes)
 		{
 			if (yes) {
@@ -89,5 +107,106 @@ namespace pcre2 {
 			self.config.match_config.max_jit_stack_size = bytes;
 			return self;
 		}
+
+		/// Compile a second copy of the pattern that calls out before every
+		/// item, for the `find_at` and `is_match_at` overloads taking a
+		/// deadline or a `CancellationToken`. They check every few hundred
+		/// callouts, which makes them slower than plain searches but lets
+		/// them stop a runaway search. Without this, they can only stop at
+		/// callouts written into the pattern.
+		RegexOptions& interruptible(this auto& self, bool yes)
+		{
+			self.config.interruptible = yes;
+			return self;
+		}
+
+		/// Picks the matcher for searches. `MatchEngine::Dfa` suits patterns
+		/// from untrusted sources, since no subject can make it backtrack
+		/// exponentially. Nested repeats can still make it slow on long
+		/// subjects, so pair it with a deadline when that matters. It isn't
+		/// JIT compiled, and `is_match` stops at the shortest match.
+		/// Substitutions and searches that report capture groups, such as
+		/// `captures` and `extract_columns`, always backtrack.
+		RegexOptions& engine(this auto& self, MatchEngine engine)
+		{
+			self.config.match_config.engine = engine;
+			return self;
+		}
+
+		/// JIT compile for partial matching too, so that a `StreamMatcher`
+		/// doesn't have to fall back to the interpreter.
+		RegexOptions& streaming(this auto& self, bool yes)
+		{
+			self.config.streaming = yes;
+			return self;
+		}
+
+		/// Limits how many times a search may backtrack, which bounds the
+		/// time a single search can take on pathological input. A search
+		/// that gets there fails with `ErrorKind::Limit`.
+		RegexOptions& match_limit(this auto& self, std::optional<uint32_t> limit)
+		{
+			self.config.match_config.match_limit = limit;
+			return self;
+		}
+
+		/// Limits how deep backtracking may nest. Only the interpreter
+		/// checks it.
+		RegexOptions& depth_limit(this auto& self, std::optional<uint32_t> limit)
+		{
+			self.config.match_config.depth_limit = limit;
+			return self;
+		}
+
+		/// Limits the heap, in KiB, the interpreter may use to remember
+		/// where to backtrack to.
+		RegexOptions& heap_limit(this auto& self, std::optional<uint32_t> kib)
+		{
+			self.config.match_config.heap_limit = kib;
+			return self;
+		}
+
+		/// Retry searches that run into a limit with PCRE2's DFA matcher.
+		/// It finds the same matches in time linear in the subject for most
+		/// patterns, but reports the longest one at the leftmost position
+		/// and no capture groups, so searches that report them don't retry.
+		/// Patterns it doesn't support, such as ones with backreferences,
+		/// still fail with `ErrorKind::Limit`.
+		RegexOptions& dfa_fallback(this auto& self, bool yes)
+		{
+			self.config.match_config.dfa_fallback = yes;
+			return self;
+		}
+
+		/// Keep one stack of match data per CPU instead of picking one by
+		/// thread, so a search tends to reuse match data that is already in
+		/// its core's cache. Only has an effect on Linux.
+		RegexOptions& per_cpu_scratch(this auto& self, bool yes)
+		{
+			self.config.match_config.shards = yes ? ShardPolicy::Cpu : ShardPolicy::Thread;
+			return self;
+		}
+
+		/// Don't give the regex a match data pool. Searches borrow match data
+		/// from a per-thread arena shared by every regex built this way,
+		/// which saves a lot of memory in processes holding many regexes.
+		RegexOptions& shared_scratch(this auto& self, bool yes)
+		{
+			self.config.match_config.shared_scratch = yes;
+			return self;
+		}
+
+		/// Allocate the compiled code, match contexts, match data, JIT stack
+		/// control blocks and the interpreter's heap frames through
+		/// `allocator` instead of `malloc`. See `BumpAllocator`,
+		/// `HugePageAllocator` and `CountingAllocator`.
+		///
+		/// Match data borrowed from the shared arena of `shared_scratch`
+		/// belongs to no regex in particular and still uses `malloc`.
+		RegexOptions& allocator(this auto& self, std::shared_ptr<Allocator> allocator)
+		{
+			self.config.allocator = std::move(allocator);
+			return self;
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,643 @@
+﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include "code.h"
+#include "compile_context.h"
+#include "config.h"
+#include "error.h"
+#include "literal.h"
+#include "match_data.h"
+#include "prefilter.h"
+#include "regex.h"
+#include "regex_builder.h"
+#include "traits.h"
+#include <algorithm>
+#include <expected>
+#include <initializer_list>
+#include <optional>
+#include <pcre2.h>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pcre2 {
+
+	/// The set of patterns in a `RegexSet` that matched a subject.
+	struct SetMatches
+	{
+		std::vector<bool> matches;
+
+		/// Whether the pattern at index `i` matched.
+		inline auto matched(this const SetMatches& self, size_t i) -> bool
+		{
+			return self.matches[i];
+		}
+
+		/// Whether any pattern matched.
+		auto matched_any(this const SetMatches& self) noexcept -> bool
+		{
+			return std::find(self.matches.begin(), self.matches.end(), true) != self.matches.end();
+		}
+
+		/// The number of patterns in the set that produced this value.
+		inline auto len(this const SetMatches& self) noexcept -> size_t
+		{
+			return self.matches.size();
+		}
+
+		/// The indices of the patterns that matched, in ascending order.
+		auto indices(this const SetMatches& self) -> std::vector<size_t>
+		{
+			std::vector<size_t> result;
+			for (size_t i = 0; i < self.matches.size(); i++) {
+				if (self.matches[i]) {
+					result.push_back(i);
+				}
+			}
+			return result;
+		}
+	};
+
+	/// Matches many patterns against a subject.
+	///
+	/// Most patterns contain some literal text that every match must contain:
+	/// the whole pattern if it is a fixed string, or what `Prefilter` works
+	/// out otherwise. A set collects these literals in a `LiteralSet` and
+	/// scans the subject for all of them in one pass. Only the patterns whose
+	/// literal turns up are searched, each as a regex of its own, which keeps
+	/// PCRE2's start optimizations, the match limits and the stop at the first
+	/// match per pattern. A subject that contains none of the literals costs
+	/// that one pass, however many patterns there are.
+	///
+	/// The patterns without such a literal are joined into a single
+	/// alternation in which every branch ends like this:
+	///
+	/// ```text
+	/// (?:pattern)(?C{index})(*THEN)(*FAIL)
+	/// ```
+	///
+	/// When a branch reaches its callout, the pattern at `index` matches at the
+	/// current start position, which is recorded along with the match bounds.
+	/// The branch then fails on purpose and `(*THEN)` moves straight on to the
+	/// next branch. Since start positions are tried in order and each branch
+	/// backtracks exactly like its pattern would on its own, the first time a
+	/// pattern is recorded is the same match `find` returns for it. Every
+	/// branch is still tried at every start position, so this only saves the
+	/// overhead of separate searches, not the work of running each pattern.
+	/// The search stops as soon as every pattern in it has matched.
+	///
+	/// Some patterns change meaning when they are pasted into a bigger one:
+	/// numbered back references and recursion, backtracking verbs, callouts,
+	/// `\K` and so on. Those are kept as separate regexes and searched one by
+	/// one. The same happens to a pattern whose branch fails to compile, e.g.
+	/// because the combined pattern got too large; the set splits the
+	/// alternation into batches that PCRE2 accepts.
+	template<typename CharT>
+	class basic_regex_set
+	{
+	public:
+		using char_type = CharT;
+		using string_type = std::basic_string<CharT>;
+		using string_view_type = std::basic_string_view<CharT>;
+		using Code = pcre2::Code<CharT>;
+		using CompileContext = pcre2::CompileContext<CharT>;
+		using MatchData = pcre2::MatchData<CharT>;
+		using MatchDataPool = pcre2::MatchDataPool<CharT>;
+		using MatchDataPoolGuard = pcre2::MatchDataPoolGuard<CharT>;
+		using MatchDataLease = pcre2::MatchDataLease<CharT>;
+		using Regex = pcre2::basic_regex<CharT>;
+		using Match = pcre2::Match<CharT>;
+
+		/// Whether `pattern` keeps its meaning when it becomes one branch of a
+		/// bigger pattern. This errs on the side of saying no: a false negative
+		/// only costs a separate search.
+		static auto is_combinable(string_view_type pattern) noexcept -> bool
+		{
+			auto at = [&](size_t i) -> CharT { return i < pattern.size() ? pattern[i] : CharT(0); };
+			auto is_digit = [](CharT c) { return c >= '0' && c <= '9'; };
+			auto is_alpha = [](CharT c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); };
+
+			for (size_t i = 0; i < pattern.size(); i++) {
+				auto c = pattern[i];
+				if (c == '\\') {
+					switch (at(i + 1))
+					{
+					// Back references, \K and quoting that may run past the end
+					// of the branch.
+					case 'g':
+					case 'k':
+					case 'K':
+					case 'Q':
+						return false;
+					default:
+						i += 1;
+						continue;
+					}
+				}
+				if (c != '(') {
+					continue;
+				}
+				// Verbs such as (*COMMIT) or (*ACCEPT) act on the whole match.
+				if (at(i + 1) == '*') {
+					return false;
+				}
+				if (at(i + 1) != '?') {
+					continue;
+				}
+				auto next = at(i + 2);
+				// Recursion, subroutine calls, conditions and callouts.
+				if (next == 'R' || next == '&' || next == '(' || next == 'C' || next == '+' || is_digit(next)) {
+					return false;
+				}
+				if (next == 'P' && at(i + 3) == '>') {
+					return false;
+				}
+				if (next == '-' && is_digit(at(i + 3))) {
+					return false;
+				}
+				// An inline (?x) would turn the rest of the line, including
+				// the end of the branch, into a comment.
+				for (auto j = i + 2; is_alpha(at(j)) || at(j) == '-' || at(j) == '^'; j++) {
+					if (at(j) == 'x') {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+	private:
+		using callout_block_type = typename traits<CharT>::callout_block_type;
+
+		/// A group of patterns compiled into a single alternation.
+		struct Batch
+		{
+			/// The indices of the patterns in this batch.
+			std::vector<size_t> patterns;
+			std::unique_ptr<Code> code;
+			/// Empty with `shared_scratch`.
+			MatchDataPool match_data;
+			/// The number of offset pairs a search needs, group 0 included.
+			uint32_t pairs;
+		};
+
+		/// The state shared with the callout during a search.
+		struct Search
+		{
+			std::vector<bool>& matches;
+			std::vector<std::optional<Match>>* first;
+			const CharT* subject;
+			/// The number of patterns in the current batch not seen yet.
+			size_t remaining;
+			/// Stop at the first pattern that matches.
+			bool any;
+			/// Set when the callout cut the search short.
+			bool stopped;
+		};
+
+		/// The configuration used to build the set.
+		Config config;
+		/// The original patterns, by index.
+		std::vector<string_type> pattern_strings;
+		/// The patterns that were combined into alternations.
+		std::vector<Batch> batches;
+		/// The patterns that must be searched on their own.
+		std::vector<std::pair<size_t, Regex>> standalone;
+		/// The patterns that are only searched when their literal occurs in
+		/// the subject. `needles.literals[i]` belongs to `filtered[i]`.
+		std::vector<std::pair<size_t, Regex>> filtered;
+		LiteralSet<CharT> needles;
+
+		basic_regex_set(Config config,
+			std::vector<string_type> patterns,
+			std::vector<Batch> batches,
+			std::vector<std::pair<size_t, Regex>> standalone,
+			std::vector<std::pair<size_t, Regex>> filtered,
+			LiteralSet<CharT> needles
+		) noexcept
+			: config(config)
+			, pattern_strings(std::move(patterns))
+			, batches(std::move(batches))
+			, standalone(std::move(standalone))
+			, filtered(std::move(filtered))
+			, needles(std::move(needles))
+		{
+		}
+
+		/// A literal that every match of `pattern` contains and that is long
+		/// enough for `LiteralSet`, or nothing.
+		static auto needle(string_view_type pattern, const Config& config) -> std::optional<Literal<CharT>>
+		{
+			auto literal = Literal<CharT>::parse(pattern, config);
+			if (!literal) {
+				auto prefilter = Prefilter<CharT>::analyze(pattern, config);
+				if (!prefilter) {
+					return std::nullopt;
+				}
+				// Every match contains both, and the longer one rules out
+				// more subjects.
+				auto& prefix = prefilter->prefix;
+				auto& required = prefilter->required;
+				literal = required && (!prefix || required->needle.size() > prefix->needle.size())
+					? std::move(required)
+					: std::move(prefix);
+			}
+			if (literal->needle.size() < 2) {
+				return std::nullopt;
+			}
+			return literal;
+		}
+
+		static auto compile_code(
+			string_view_type pattern,
+			const Config& config
+		) -> std::expected<std::unique_ptr<Code>, Error> {
+			auto ctx = std::make_unique<CompileContext>(GeneralContext<CharT>::make_shared(config.allocator));
+			if (config.crlf) {
+				auto rc = ctx->set_newline(PCRE2_NEWLINE_ANYCRLF);
+				if (!rc) return std::unexpected(rc.error());
+			}
+			return Code::make_unique(pattern, config.compile_options(), std::move(ctx));
+		}
+
+		/// Batches report matches from callouts, and the DFA matcher calls
+		/// them for paths it drops later on, so batches always backtrack and
+		/// never fall back to it. They still run into the limits.
+		static auto batch_match_config(MatchConfig config) noexcept -> MatchConfig
+		{
+			config.engine = MatchEngine::Backtrack;
+			config.dfa_fallback = false;
+			return config;
+		}
+
+		/// Compiles `indices` into one alternation, or into as many as it takes
+		/// for PCRE2 to accept them. Patterns that don't compile even on their
+		/// own as a branch are appended to `rejected`.
+		static auto compile_batches(
+			const std::vector<string_type>& patterns,
+			std::span<const size_t> indices,
+			const Config& config,
+			std::vector<Batch>& batches,
+			std::vector<size_t>& rejected
+		) -> void {
+			if (indices.empty()) {
+				return;
+			}
+
+			string_type combined;
+			auto append = [&](std::string_view ascii) {
+				combined.append(ascii.begin(), ascii.end());
+				};
+			// Patterns may reuse group names.
+			append("(?J)(?:");
+			for (size_t i = 0; i < indices.size(); i++) {
+				if (i != 0) {
+					append("|");
+				}
+				append("(?:");
+				combined.append(patterns[indices[i]]);
+				if (config.extended) {
+					// Ends a trailing comment.
+					append("\n");
+				}
+				append(")(?C{");
+				append(std::to_string(indices[i]));
+				append("})(*THEN)(*FAIL)");
+			}
+			append(")");
+
+			auto code = compile_code(combined, config);
+			if (!code) {
+				if (indices.size() == 1) {
+					rejected.push_back(indices[0]);
+					return;
+				}
+				auto half = indices.size() / 2;
+				compile_batches(patterns, indices.first(half), config, batches, rejected);
+				compile_batches(patterns, indices.subspan(half), config, batches, rejected);
+				return;
+			}
+
+			switch (config.jit)
+			{
+			case JITChoice::Never:
+				break;
+			case JITChoice::Always:
+			case JITChoice::Attempt:
+				// The patterns compiled on their own already, so a failure
+				// here is down to the combination. Fall back to the
+				// interpreter rather than failing the whole set.
+				(*code)->jit_compile();
+				break;
+			}
+
+			auto match_data = config.match_config.shared_scratch
+				? MatchDataPool()
+				: MatchDataPool::create(
+					[code = code->get(), config = batch_match_config(config.match_config)]()
+					{
+						return new MatchData(config, code);
+					},
+					config.match_config.shards);
+			auto pairs = static_cast<uint32_t>((*code)->capture_count().value_or(1));
+			batches.push_back(Batch{
+				std::vector<size_t>(indices.begin(), indices.end()),
+				std::move(*code),
+				std::move(match_data),
+				pairs
+				});
+		}
+
+		/// Borrows match data for searching `batch`.
+		auto borrow(this const basic_regex_set& self, const Batch& batch) -> MatchDataLease
+		{
+			if (self.config.match_config.shared_scratch) {
+				auto& arena = ScratchArena<CharT>::local();
+				auto data = arena.acquire(batch.pairs, batch_match_config(self.config.match_config));
+				auto ptr = data.get();
+				return MatchDataLease{ std::nullopt, ScratchLease<CharT>(arena, std::move(data)), ptr };
+			}
+			auto guard = batch.match_data.get();
+			auto ptr = &guard.deref_mut();
+			return MatchDataLease{ std::move(guard), {}, ptr };
+		}
+
+		static auto on_callout(callout_block_type* block, void* data) -> int
+		{
+			auto& search = *static_cast<Search*>(data);
+			size_t index = 0;
+			for (auto p = block->callout_string; *p != 0; p++) {
+				index = index * 10 + static_cast<size_t>(*p - '0');
+			}
+			if (!search.matches[index]) {
+				search.matches[index] = true;
+				if (search.first) {
+					(*search.first)[index] = Match{ search.subject, block->start_match, block->current_position };
+				}
+				search.remaining -= 1;
+				if (search.any || search.remaining == 0) {
+					search.stopped = true;
+					return PCRE2_ERROR_CALLOUT;
+				}
+			}
+			return 0;
+		}
+
+		auto search(
+			this const basic_regex_set& self,
+			string_view_type subject,
+			uint32_t options,
+			std::vector<std::optional<Match>>* first,
+			bool any
+		) -> std::expected<SetMatches, Error> {
+			SetMatches result{ std::vector<bool>(self.pattern_strings.size(), false) };
+			if (first) {
+				first->assign(self.pattern_strings.size(), std::nullopt);
+			}
+
+			// Runs a pattern that is searched on its own. Returns true if the
+			// search is over.
+			auto search_one = [&](size_t index, const Regex& re) -> std::expected<bool, Error>
+				{
+					auto m = (options & PCRE2_NO_UTF_CHECK) != 0
+						? re.find(trusted_utf<CharT>(subject))
+						: re.find(subject);
+					if (!m) {
+						return std::unexpected(m.error());
+					}
+					if (*m) {
+						result.matches[index] = true;
+						if (first) {
+							(*first)[index] = **m;
+						}
+						return any;
+					}
+					return false;
+				};
+
+			if (!self.filtered.empty()) {
+				std::vector<bool> candidates;
+				// Scanning an invalid subject would hide PCRE2's error, so
+				// leave it to the first search to report it.
+				if (self.config.utf && !self.config.ucp && (options & PCRE2_NO_UTF_CHECK) == 0) {
+					if (traits<CharT>::valid_utf(subject)) {
+						options |= PCRE2_NO_UTF_CHECK;
+						self.needles.scan(subject, candidates);
+					}
+					else {
+						candidates.assign(self.filtered.size(), true);
+					}
+				}
+				else {
+					self.needles.scan(subject, candidates);
+				}
+				for (size_t i = 0; i < self.filtered.size(); i++) {
+					if (!candidates[i]) {
+						continue;
+					}
+					auto done = search_one(self.filtered[i].first, self.filtered[i].second);
+					if (!done) {
+						return std::unexpected(done.error());
+					}
+					if (*done) {
+						return result;
+					}
+				}
+			}
+
+			for (const auto& batch : self.batches) {
+				Search state{ result.matches, first, subject.data(), batch.patterns.size(), any, false };
+				auto match_data = self.borrow(batch);
+				traits<CharT>::set_callout(match_data->match_context, &on_callout, &state);
+				auto rc = match_data->find(batch.code.get(), subject, 0, options);
+				// A shared match context is used by other regexes too, and
+				// `state` is about to go away.
+				traits<CharT>::set_callout(match_data->match_context, nullptr, nullptr);
+				MatchDataLease::put(match_data);
+
+				if (!rc && !state.stopped) {
+					return std::unexpected(rc.error());
+				}
+				if (any && state.stopped) {
+					return result;
+				}
+				// The first batch has validated the subject.
+				options |= PCRE2_NO_UTF_CHECK;
+			}
+
+			for (const auto& [index, re] : self.standalone) {
+				auto done = search_one(index, re);
+				if (!done) {
+					return std::unexpected(done.error());
+				}
+				if (*done) {
+					return result;
+				}
+			}
+			return result;
+		}
+
+	public:
+
+		basic_regex_set(basic_regex_set&& rhs) noexcept = default;
+
+		basic_regex_set(const basic_regex_set& rhs) = delete;
+		basic_regex_set operator=(const basic_regex_set& rhs) = delete;
+
+		static inline auto jit_compile(std::initializer_list<string_view_type> patterns) -> std::expected<basic_regex_set, Error>
+		{
+			auto options = RegexOptions{};
+			options.jit(true);
+			return jit_compile(patterns, options);
+		}
+
+		static inline auto jit_compile(std::initializer_list<string_view_type> patterns, RegexOptions& s) -> std::expected<basic_regex_set, Error>
+		{
+			return jit_compile<std::initializer_list<string_view_type>>(patterns, s);
+		}
+
+		/// Builds a set from any range of strings. Every pattern is compiled
+		/// with the same options. If any pattern fails to compile, its error is
+		/// returned.
+		template<std::ranges::input_range R>
+			requires std::convertible_to<std::ranges::range_reference_t<R>, string_view_type>
+		static auto jit_compile(const R& patterns, RegexOptions& s) -> std::expected<basic_regex_set, Error>
+		{
+			Config config = s.config;
+			// PCRE2_LITERAL applies to a whole pattern, so fixed strings are
+			// joined as escaped copies instead.
+			Config combined = config;
+			combined.literal = false;
+			combined.extended = combined.extended && !config.literal;
+
+			std::vector<string_type> pattern_strings;
+			std::vector<string_type> sources;
+			std::vector<size_t> combinable;
+			std::vector<size_t> separate;
+			std::vector<size_t> literal;
+			std::vector<Literal<CharT>> literals;
+			for (auto&& p : patterns) {
+				string_view_type pattern = p;
+				auto code = compile_code(pattern, config);
+				if (!code) {
+					return std::unexpected(code.error());
+				}
+				auto backrefs = (*code)->backref_max();
+				if (!backrefs) {
+					return std::unexpected(backrefs.error());
+				}
+
+				auto index = pattern_strings.size();
+				sources.push_back(config.literal ? escape(pattern) : string_type(pattern));
+				if (auto n = needle(pattern, config)) {
+					literal.push_back(index);
+					literals.push_back(std::move(*n));
+				}
+				else if (*backrefs == 0 && is_combinable(sources.back())) {
+					combinable.push_back(index);
+				}
+				else {
+					separate.push_back(index);
+				}
+				pattern_strings.emplace_back(pattern);
+			}
+
+			std::vector<Batch> batches;
+			compile_batches(sources, combinable, combined, batches, separate);
+			std::sort(separate.begin(), separate.end());
+
+			std::vector<std::pair<size_t, Regex>> standalone;
+			standalone.reserve(separate.size());
+			for (auto index : separate) {
+				auto re = Regex::jit_compile(pattern_strings[index], s);
+				if (!re) {
+					return std::unexpected(re.error());
+				}
+				standalone.emplace_back(index, std::move(*re));
+			}
+
+			std::vector<std::pair<size_t, Regex>> filtered;
+			filtered.reserve(literal.size());
+			for (auto index : literal) {
+				auto re = Regex::jit_compile(pattern_strings[index], s);
+				if (!re) {
+					return std::unexpected(re.error());
+				}
+				filtered.emplace_back(index, std::move(*re));
+			}
+
+			return basic_regex_set(config,
+				std::move(pattern_strings),
+				std::move(batches),
+				std::move(standalone),
+				std::move(filtered),
+				LiteralSet<CharT>(std::move(literals)));
+		}
+
+		/// The number of patterns in the set.
+		inline auto len(this const basic_regex_set& self) noexcept -> size_t
+		{
+			return self.pattern_strings.size();
+		}
+
+		/// The patterns in the set, in the order they were given.
+		inline auto patterns(this const basic_regex_set& self) noexcept -> std::span<const string_type>
+		{
+			return self.pattern_strings;
+		}
+
+		/// Returns true if any pattern in the set matches `subject`.
+		inline auto is_match(this const basic_regex_set& self, string_view_type subject) -> std::expected<bool, Error>
+		{
+			return self.search(subject, 0, nullptr, true)
+				.transform([](const SetMatches& m) { return m.matched_any(); });
+		}
+
+		inline auto is_match(this const basic_regex_set& self, trusted_utf<CharT> subject) -> std::expected<bool, Error>
+		{
+			return self.search(subject.subject, PCRE2_NO_UTF_CHECK, nullptr, true)
+				.transform([](const SetMatches& m) { return m.matched_any(); });
+		}
+
+		/// Returns which patterns in the set match `subject`.
+		inline auto matches(this const basic_regex_set& self, string_view_type subject) -> std::expected<SetMatches, Error>
+		{
+			return self.search(subject, 0, nullptr, false);
+		}
+
+		inline auto matches(this const basic_regex_set& self, trusted_utf<CharT> subject) -> std::expected<SetMatches, Error>
+		{
+			return self.search(subject.subject, PCRE2_NO_UTF_CHECK, nullptr, false);
+		}
+
+		/// Returns the leftmost-first match of every pattern in the set, or
+		/// `nullopt` for the patterns that don't match. Each entry is what
+		/// `find` on that pattern alone would return.
+		auto first_matches(
+			this const basic_regex_set& self,
+			string_view_type subject
+		) -> std::expected<std::vector<std::optional<Match>>, Error> {
+			std::vector<std::optional<Match>> first;
+			return self.search(subject, 0, &first, false)
+				.transform([&](const SetMatches&) { return std::move(first); });
+		}
+
+		auto first_matches(
+			this const basic_regex_set& self,
+			trusted_utf<CharT> subject
+		) -> std::expected<std::vector<std::optional<Match>>, Error> {
+			std::vector<std::optional<Match>> first;
+			return self.search(subject.subject, PCRE2_NO_UTF_CHECK, &first, false)
+				.transform([&](const SetMatches&) { return std::move(first); });
+		}
+	};
+
+	using regex_set = basic_regex_set<char>;
+	using u8regex_set = basic_regex_set<char8_t>;
+	using wregex_set = basic_regex_set<wchar_t>;
+	using u16regex_set = basic_regex_set<char16_t>;
+	using u32regex_set = basic_regex_set<char32_t>;
+}
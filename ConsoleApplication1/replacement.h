@@ -0,0 +1,208 @@
+﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include "capture_locations.h"
+#include "captures.h"
+#include "error.h"
+#include <algorithm>
+#include <expected>
+#include <map>
+#include <pcre2.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pcre2 {
+
+	/// A replacement template that has been parsed once, ahead of time.
+	///
+	/// `substitute` hands its replacement string to `pcre2_substitute`, which
+	/// parses the `$n`/`${name}` syntax again on every call. A `Replacement`
+	/// is instead compiled once against a regex: group names are resolved to
+	/// indices up front and the template is stored as a flat list of literal
+	/// spans, each optionally followed by a group reference. Expanding it is
+	/// then just copying out of the literals and the ovector.
+	///
+	/// The syntax is the one `substitute` uses (`PCRE2_SUBSTITUTE_EXTENDED`
+	/// with unknown and unset groups expanding to nothing):
+	///
+	/// * `$$` is a literal `$`.
+	/// * `$n`, `${n}`, `$name` and `${name}` insert a capture group.
+	/// * `\` escapes the next character. `\a`, `\e`, `\f`, `\n`, `\r` and `\t`
+	/// have their usual meaning and any non-alphanumeric character stands for
+	/// itself.
+	///
+	/// Case forcing (`\U`, `\L`, ...), conditional substitutions
+	/// (`${n:+set:unset}`) and code point escapes are not supported and fail
+	/// to compile.
+	///
+	/// A `Replacement` satisfies `Replacer`, so it can be used with
+	/// `replace`, `replacen` and `replace_all` as well as `substitute`.
+	template<typename CharT>
+	struct Replacement
+	{
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		struct Part
+		{
+			/// The literal text written first, as offsets into `literals`.
+			size_t start;
+			size_t end;
+			/// The capture group expanded after the literal, or `npos`.
+			size_t group;
+		};
+
+		/// The literal text of every part, concatenated.
+		std::basic_string<CharT> literals;
+		std::vector<Part> parts;
+
+		/// Parses `replacement` for a regex with `captures_len` groups
+		/// (including the implicit group 0) and the given name index.
+		static auto compile(
+			std::basic_string_view<CharT> replacement,
+			size_t captures_len,
+			const std::map<std::basic_string<CharT>, size_t, std::less<void>>& idx
+		) -> std::expected<Replacement, Error> {
+			auto is_digit = [](CharT c) { return c >= '0' && c <= '9'; };
+			auto is_word = [&](CharT c) {
+				return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+				};
+
+			Replacement result;
+			size_t start = 0;
+			// Ends the current literal span, attaching a group reference. Groups
+			// that don't exist in the pattern expand to nothing, just like with
+			// PCRE2_SUBSTITUTE_UNKNOWN_UNSET, so they are dropped here.
+			auto push = [&](size_t group) {
+				if (group >= captures_len) {
+					group = npos;
+				}
+				result.parts.push_back(Part{ start, result.literals.size(), group });
+				start = result.literals.size();
+				};
+			// Resolves a group given by number or by name.
+			auto resolve = [&](std::basic_string_view<CharT> name) -> size_t {
+				if (is_digit(name[0])) {
+					size_t group = 0;
+					for (auto c : name) {
+						group = std::min<size_t>(group * 10 + static_cast<size_t>(c - '0'), npos - 1);
+					}
+					return group;
+				}
+				if (auto iter = idx.find(name); iter != idx.end()) {
+					return iter->second;
+				}
+				return npos;
+				};
+
+			size_t i = 0;
+			while (i < replacement.size()) {
+				auto c = replacement[i];
+				if (c == '\\') {
+					if (i + 1 >= replacement.size()) {
+						return std::unexpected(Error::replacement(PCRE2_ERROR_BADREPESCAPE, i));
+					}
+					auto e = replacement[i + 1];
+					switch (e)
+					{
+					case 'a': result.literals.push_back(CharT(7)); break;
+					case 'e': result.literals.push_back(CharT(27)); break;
+					case 'f': result.literals.push_back(CharT('\f')); break;
+					case 'n': result.literals.push_back(CharT('\n')); break;
+					case 'r': result.literals.push_back(CharT('\r')); break;
+					case 't': result.literals.push_back(CharT('\t')); break;
+					default:
+						if (is_word(e)) {
+							return std::unexpected(Error::replacement(PCRE2_ERROR_BADREPESCAPE, i));
+						}
+						result.literals.push_back(e);
+						break;
+					}
+					i += 2;
+				}
+				else if (c == '$') {
+					if (i + 1 >= replacement.size()) {
+						return std::unexpected(Error::replacement(PCRE2_ERROR_BADREPLACEMENT, i));
+					}
+					auto next = replacement[i + 1];
+					if (next == '$') {
+						result.literals.push_back(next);
+						i += 2;
+					}
+					else if (next == '{') {
+						auto close = replacement.find(CharT('}'), i + 2);
+						if (close == replacement.npos) {
+							return std::unexpected(Error::replacement(PCRE2_ERROR_REPMISSINGBRACE, i));
+						}
+						auto name = replacement.substr(i + 2, close - i - 2);
+						auto valid = !name.empty() && std::all_of(name.begin(), name.end(), is_word)
+							&& (!is_digit(name[0]) || std::all_of(name.begin(), name.end(), is_digit));
+						if (!valid) {
+							return std::unexpected(Error::replacement(PCRE2_ERROR_BADSUBSTITUTION, i));
+						}
+						push(resolve(name));
+						i = close + 1;
+					}
+					else if (is_digit(next)) {
+						auto end = i + 1;
+						while (end < replacement.size() && is_digit(replacement[end])) {
+							end += 1;
+						}
+						push(resolve(replacement.substr(i + 1, end - i - 1)));
+						i = end;
+					}
+					else if (is_word(next)) {
+						auto end = i + 1;
+						while (end < replacement.size() && is_word(replacement[end])) {
+							end += 1;
+						}
+						push(resolve(replacement.substr(i + 1, end - i - 1)));
+						i = end;
+					}
+					else {
+						return std::unexpected(Error::replacement(PCRE2_ERROR_BADREPLACEMENT, i));
+					}
+				}
+				else {
+					result.literals.push_back(c);
+					i += 1;
+				}
+			}
+			if (start < result.literals.size() || result.parts.empty()) {
+				push(npos);
+			}
+			return result;
+		}
+
+		/// Writes the expansion for the match recorded in `ovector` to `out`.
+		template<typename OutputIt>
+		auto expand(
+			this const Replacement& self,
+			const CharT* subject,
+			std::span<const size_t> ovector,
+			OutputIt out
+		) -> OutputIt {
+			for (const auto& part : self.parts) {
+				out = std::copy(self.literals.data() + part.start, self.literals.data() + part.end, out);
+				if (part.group == npos) {
+					continue;
+				}
+				if (auto loc = capture_at(ovector, part.group)) {
+					auto& [s, e] = *loc;
+					out = std::copy(subject + s, subject + e, out);
+				}
+			}
+			return out;
+		}
+
+		template<typename OutputIt>
+		inline auto append(
+			this const Replacement& self,
+			const CapturesRef<CharT>& caps,
+			OutputIt out
+		) -> OutputIt {
+			return self.expand(caps.subject, caps.ovector, out);
+		}
+	};
+}
\ No newline at end of file
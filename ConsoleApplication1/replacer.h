@@ -0,0 +1,61 @@
+﻿#pragma once
+#include "captures.h"
+#include <algorithm>
+#include <concepts>
+#include <functional>
+#include <string_view>
+
+namespace pcre2 {
+
+	/// A type that knows how to write the replacement for a single match.
+	///
+	/// This is the extension point used by `replace`, `replacen` and
+	/// `replace_all`. Any type with an `append(caps, out)` member that writes
+	/// the replacement for `caps` to `out` and returns the advanced iterator
+	/// is a replacer. Closures are accepted too, see `replace_append`.
+	template<typename R, typename CharT, typename OutputIt>
+	concept Replacer = requires(R& r, const CapturesRef<CharT>& caps, OutputIt out) {
+		{ r.append(caps, out) } -> std::convertible_to<OutputIt>;
+	};
+
+	/// Writes the replacement for `caps` to `out` and returns the advanced
+	/// iterator.
+	///
+	/// `replacer` may be any of:
+	///
+	/// * A `Replacer`.
+	/// * A callable taking `(const CapturesRef&, OutputIt)` that writes the
+	/// replacement itself and returns the advanced iterator.
+	/// * A callable taking `(const CapturesRef&)` that returns something
+	/// convertible to a string view, or a single character.
+	template<typename CharT, typename OutputIt, typename R>
+	auto replace_append(R& replacer, const CapturesRef<CharT>& caps, OutputIt out) -> OutputIt
+	{
+		if constexpr (Replacer<R, CharT, OutputIt>) {
+			return replacer.append(caps, out);
+		}
+		else if constexpr (std::invocable<R&, const CapturesRef<CharT>&, OutputIt>) {
+			return std::invoke(replacer, caps, out);
+		}
+		else {
+			static_assert(
+				std::invocable<R&, const CapturesRef<CharT>&>,
+				"a replacer must be a Replacer or a callable taking the captures of a match");
+
+			decltype(auto) replacement = std::invoke(replacer, caps);
+			using result_type = decltype(replacement);
+			if constexpr (std::convertible_to<result_type, std::basic_string_view<CharT>>) {
+				std::basic_string_view<CharT> view = replacement;
+				return std::copy(view.begin(), view.end(), out);
+			}
+			else {
+				static_assert(
+					std::convertible_to<result_type, CharT>,
+					"a replacement callback must return a string or a character");
+				*out = static_cast<CharT>(replacement);
+				++out;
+				return out;
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include "capture_locations.h"
+#include "code.h"
+#include "match_data.h"
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <pcre2.h>
+#include <tuple>
+#include <vector>
+
+namespace pcre2 {
+	/// Scratch space for running searches, owned by the caller.
+	///
+	/// Searches normally borrow their match data from a pool inside the
+	/// regex, which costs at least an atomic load and store per search even
+	/// on the pool's fast path. A thread that keeps its own `Scratch` and
+	/// passes it to the overloads of `is_match`, `find_at`, `find_iter` and
+	/// `captures_read_at` that take one skips the pool entirely.
+	///
+	/// A `Scratch` belongs to the regex that created it (see
+	/// `basic_regex::new_scratch`) and may only be used by one search at a
+	/// time. After `captures_read_at`, `get` returns the capture groups of
+	/// the match. After other searches only group 0 is meaningful.
+	template<typename CharT>
+	struct Scratch
+	{
+		/// The code of the regex this scratch space was created for.
+		const Code<CharT>* code;
+		std::unique_ptr<MatchData<CharT>> data;
+
+		Scratch(const Code<CharT>* code, std::unique_ptr<MatchData<CharT>> data) noexcept : code(code), data(std::move(data)) {}
+
+		Scratch(const Scratch& rhs) = delete;
+
+		Scratch(Scratch&& rhs) noexcept = default;
+
+		Scratch& operator=(Scratch&& rhs) noexcept = default;
+
+		auto get(this const Scratch& self, size_t i) noexcept -> std::optional<std::tuple<size_t, size_t>>
+		{
+			return capture_at(self.data->ovector(), i);
+		}
+
+		inline auto len(this const Scratch& self) noexcept -> size_t
+		{
+			return self.data->ovector().size() / 2;
+		}
+	};
+
+	/// Match data shared by every regex built with `shared_scratch`, one
+	/// arena per thread.
+	///
+	/// Instead of a pool per regex, each thread keeps a short free list of
+	/// match data, each with its own match context and JIT stack. They are
+	/// not tied to a pattern: they are sized for the largest capture count
+	/// and JIT stack any regex has asked the arena for so far. Usually the
+	/// list holds a single entry; it only grows when searches nest, such as
+	/// calling `is_match` while iterating over `find_iter` on one thread.
+	template<typename CharT>
+	class ScratchArena
+	{
+		std::vector<std::unique_ptr<MatchData<CharT>>> free;
+		/// The largest number of offset pairs asked for so far.
+		uint32_t pairs = 1;
+		/// The largest JIT stack asked for so far.
+		std::optional<size_t> max_jit_stack_size;
+
+		/// The calling thread's arena while it exists: null before `local`
+		/// first creates it and again once the thread has destroyed it. A
+		/// plain pointer has no destructor, so this can still be read while
+		/// the thread's other `thread_local` objects are being destroyed.
+		static auto current() noexcept -> ScratchArena*&
+		{
+			thread_local ScratchArena* arena = nullptr;
+			return arena;
+		}
+
+		ScratchArena() noexcept
+		{
+			current() = this;
+		}
+
+	public:
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+
+		~ScratchArena()
+		{
+			current() = nullptr;
+		}
+
+		/// The calling thread's arena.
+		static auto local() -> ScratchArena&
+		{
+			thread_local ScratchArena arena;
+			return arena;
+		}
+
+		/// Whether this is the calling thread's arena, and it still exists.
+		inline auto is_local(this const ScratchArena& self) noexcept -> bool
+		{
+			return current() == &self;
+		}
+
+		/// Takes match data with room for `pairs` offset pairs and the JIT
+		/// stack `config` asks for, set up with the engine and limits in
+		/// `config`. Its `ovector` reports exactly `pairs`.
+		auto acquire(
+			this ScratchArena& self,
+			uint32_t pairs,
+			const MatchConfig& config
+		) -> std::unique_ptr<MatchData<CharT>> {
+			self.pairs = std::max(self.pairs, pairs);
+			if (config.max_jit_stack_size > self.max_jit_stack_size) {
+				self.max_jit_stack_size = config.max_jit_stack_size;
+			}
+			while (!self.free.empty()) {
+				auto data = std::move(self.free.back());
+				self.free.pop_back();
+				// Match data made before a bigger request came along is
+				// dropped and replaced by one sized for everything so far.
+				if (data->capacity() >= self.pairs
+					&& data->config.max_jit_stack_size >= self.max_jit_stack_size) {
+					data->set_ovector_len(pairs);
+					data->configure(config);
+					return data;
+				}
+			}
+			auto config_for_all = MatchConfig{};
+			config_for_all.max_jit_stack_size = self.max_jit_stack_size;
+			auto data = std::make_unique<MatchData<CharT>>(config_for_all, self.pairs);
+			data->set_ovector_len(pairs);
+			data->configure(config);
+			return data;
+		}
+
+		void release(this ScratchArena& self, std::unique_ptr<MatchData<CharT>> data)
+		{
+			self.free.push_back(std::move(data));
+		}
+
+		/// Frees all match data that isn't in use.
+		void trim(this ScratchArena& self) noexcept
+		{
+			self.free.clear();
+		}
+	};
+
+	/// Match data borrowed from a thread's `ScratchArena`, which gets it
+	/// back when this is dropped on that same thread. A lease that is moved
+	/// to another thread, or outlives its thread's arena, frees the match
+	/// data instead.
+	template<typename CharT>
+	struct ScratchLease
+	{
+		ScratchArena<CharT>* arena = nullptr;
+		std::unique_ptr<MatchData<CharT>> data;
+
+		ScratchLease() noexcept = default;
+
+		ScratchLease(ScratchArena<CharT>& arena, std::unique_ptr<MatchData<CharT>> data) noexcept
+			: arena(&arena), data(std::move(data))
+		{
+		}
+
+		ScratchLease(ScratchLease&& rhs) noexcept = default;
+
+		ScratchLease& operator=(ScratchLease&& rhs) = delete;
+
+		~ScratchLease()
+		{
+			reset();
+		}
+
+		/// Gives the match data back early.
+		void reset(this ScratchLease& self)
+		{
+			if (!self.data) {
+				return;
+			}
+			if (self.arena && self.arena->is_local()) {
+				self.arena->release(std::move(self.data));
+			}
+			else {
+				self.data.reset();
+			}
+		}
+	};
+}
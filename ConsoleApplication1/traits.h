@@ -0,0 +1,786 @@
+﻿#pragma once
+#define PCRE2_STATIC
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include <cstddef>
+#include <cstdint>
+#include <pcre2.h>
+#include <string_view>
+
+namespace pcre2 {
+
+	/// Dispatches to the `pcre2_*_8`, `pcre2_*_16` or `pcre2_*_32` entry
+	/// points based on the width of a code unit.
+	///
+	/// PCRE2 only cares about the size of a code unit, not its type, so
+	/// `char` and `char8_t` both map to the 8-bit library, `char16_t` maps to
+	/// the 16-bit library and `char32_t` maps to the 32-bit library. `wchar_t`
+	/// maps to whichever one matches the platform (16 bits on Windows, 32
+	/// bits elsewhere).
+	template<typename CharT, size_t Width = sizeof(CharT)> struct traits;
+
+	template<typename CharT> struct traits<CharT, 1>
+	{
+		typedef ::pcre2_code_8 code_type;
+		typedef ::pcre2_general_context_8 general_context_type;
+		typedef ::pcre2_compile_context_8 compile_context_type;
+		typedef ::pcre2_match_context_8 match_context_type;
+		typedef ::pcre2_callout_block_8 callout_block_type;
+		typedef ::pcre2_match_data_8 match_data_type;
+		typedef ::pcre2_jit_stack_8 jit_stack_type;
+
+		typedef CharT* char_ptr;
+		typedef const CharT* const_char_ptr;
+
+		static code_type* compile(std::basic_string_view<CharT> pattern, uint32_t options,
+			int* error, size_t* offset, compile_context_type* ctx)
+		{
+			return ::pcre2_compile_8(to(pattern.data()), pattern.size(), options, error, offset, ctx);
+		}
+
+		static void release(code_type* code)
+		{
+			::pcre2_code_free_8(code);
+		}
+
+		static int jit_compile(code_type* code, uint32_t options)
+		{
+			return ::pcre2_jit_compile_8(code, options);
+		}
+
+		static int query(const code_type* code, uint32_t what, void* where)
+		{
+			return ::pcre2_pattern_info_8(code, what, where);
+		}
+
+		static int config(uint32_t what, void* where)
+		{
+			return ::pcre2_config_8(what, where);
+		}
+
+		static general_context_type* general_context_create(
+			void* (*allocate)(size_t, void*), void (*deallocate)(void*, void*), void* data)
+		{
+			return ::pcre2_general_context_create_8(allocate, deallocate, data);
+		}
+
+		static void general_context_free(general_context_type* ctx)
+		{
+			::pcre2_general_context_free_8(ctx);
+		}
+
+		static compile_context_type* compile_context_create(general_context_type* gctx)
+		{
+			return ::pcre2_compile_context_create_8(gctx);
+		}
+
+		static void compile_context_free(compile_context_type* ctx)
+		{
+			::pcre2_compile_context_free_8(ctx);
+		}
+
+		static int set_newline(compile_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_newline_8(ctx, value);
+		}
+
+		static match_context_type* match_context_create(general_context_type* gctx)
+		{
+			return ::pcre2_match_context_create_8(gctx);
+		}
+
+		static void match_context_free(match_context_type* ctx)
+		{
+			::pcre2_match_context_free_8(ctx);
+		}
+
+		static match_data_type* match_data_create_from_pattern(const code_type* code, general_context_type* gctx)
+		{
+			return ::pcre2_match_data_create_from_pattern_8(code, gctx);
+		}
+
+		static match_data_type* match_data_create(uint32_t pairs, general_context_type* gctx)
+		{
+			return ::pcre2_match_data_create_8(pairs, gctx);
+		}
+
+		static void match_data_free(match_data_type* data)
+		{
+			::pcre2_match_data_free_8(data);
+		}
+
+		static const size_t* ovector_pointer(match_data_type* data)
+		{
+			return ::pcre2_get_ovector_pointer_8(data);
+		}
+
+		static uint32_t ovector_count(match_data_type* data)
+		{
+			return ::pcre2_get_ovector_count_8(data);
+		}
+
+		/// The name of the last `(*MARK)` passed on the way to the match,
+		/// or NULL if there was none.
+		static const CharT* get_mark(match_data_type* data)
+		{
+			return reinterpret_cast<const CharT*>(::pcre2_get_mark_8(data));
+		}
+
+		static jit_stack_type* jit_stack_create(size_t start, size_t max, general_context_type* gctx)
+		{
+			return ::pcre2_jit_stack_create_8(start, max, gctx);
+		}
+
+		static void jit_stack_free(jit_stack_type* stack)
+		{
+			::pcre2_jit_stack_free_8(stack);
+		}
+
+		static void jit_stack_assign(match_context_type* ctx, jit_stack_type* stack)
+		{
+			::pcre2_jit_stack_assign_8(ctx, nullptr, stack);
+		}
+
+		static int set_callout(match_context_type* ctx, int (*callout)(callout_block_type*, void*), void* data)
+		{
+			return ::pcre2_set_callout_8(ctx, callout, data);
+		}
+
+		static int set_match_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_match_limit_8(ctx, value);
+		}
+
+		static int set_depth_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_depth_limit_8(ctx, value);
+		}
+
+		static int set_heap_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_heap_limit_8(ctx, value);
+		}
+
+		static int execute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx)
+		{
+			return ::pcre2_match_8(code, to(subject.data()), subject.size(), start, options, data, ctx);
+		}
+
+		static int dfa_execute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx,
+			int* workspace, size_t workspace_len)
+		{
+			return ::pcre2_dfa_match_8(code, to(subject.data()), subject.size(), start, options,
+				data, ctx, workspace, workspace_len);
+		}
+
+		static int substitute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx,
+			std::basic_string_view<CharT> replacement, char_ptr output, size_t* output_length)
+		{
+			return ::pcre2_substitute_8(code, to(subject.data()), subject.size(), start, options,
+				data, ctx, to(replacement.data()), replacement.size(),
+				reinterpret_cast<PCRE2_UCHAR8*>(output), output_length);
+		}
+
+		static int error_message(int code, char_ptr buffer, size_t size)
+		{
+			return ::pcre2_get_error_message_8(code, reinterpret_cast<PCRE2_UCHAR8*>(buffer), size);
+		}
+
+		/// The number of code units at the start of a name table entry that
+		/// hold the group number. The 8-bit library stores it big-endian in
+		/// two code units.
+		static constexpr size_t table_offset()
+		{
+			return 2;
+		}
+
+		static size_t group_number(const_char_ptr entry)
+		{
+			return (static_cast<size_t>(static_cast<uint8_t>(entry[0])) << 8)
+				| static_cast<size_t>(static_cast<uint8_t>(entry[1]));
+		}
+
+		/// Returns true if `c` continues a character rather than starting one.
+		static constexpr bool is_continuation(CharT c)
+		{
+			return (static_cast<uint8_t>(c) & 0xC0) == 0x80;
+		}
+
+		/// The most code units one character takes.
+		static constexpr size_t max_char_len()
+		{
+			return 4;
+		}
+
+		/// Returns how many code units at the end of `s` belong to a
+		/// character that is cut off.
+		static size_t incomplete_suffix(std::basic_string_view<CharT> s)
+		{
+			for (size_t back = 1; back <= 4 && back <= s.size(); back++) {
+				auto c = static_cast<uint8_t>(s[s.size() - back]);
+				if ((c & 0xC0) == 0x80) {
+					continue;
+				}
+				size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+				return back < len ? back : 0;
+			}
+			return 0;
+		}
+
+		/// Returns the offset just past the character starting at `at`. This
+		/// never reads out of bounds, even if the subject is not valid UTF-8.
+		static size_t next_char(std::basic_string_view<CharT> subject, size_t at)
+		{
+			at += 1;
+			while (at < subject.size() && (static_cast<uint8_t>(subject[at]) & 0xC0) == 0x80) {
+				at += 1;
+			}
+			return at;
+		}
+
+		/// Returns true if the given string is valid UTF-8.
+		static bool valid_utf(std::basic_string_view<CharT> s)
+		{
+			size_t i = 0;
+			while (i < s.size()) {
+				auto c = static_cast<uint8_t>(s[i]);
+				size_t len = 0;
+				uint32_t cp = 0;
+				if (c < 0x80) {
+					i += 1;
+					continue;
+				}
+				else if (c >= 0xC2 && c <= 0xDF) {
+					len = 2;
+					cp = c & 0x1F;
+				}
+				else if (c >= 0xE0 && c <= 0xEF) {
+					len = 3;
+					cp = c & 0x0F;
+				}
+				else if (c >= 0xF0 && c <= 0xF4) {
+					len = 4;
+					cp = c & 0x07;
+				}
+				else {
+					return false;
+				}
+				if (s.size() - i < len) {
+					return false;
+				}
+				for (size_t j = 1; j < len; j++) {
+					auto cc = static_cast<uint8_t>(s[i + j]);
+					if ((cc & 0xC0) != 0x80) {
+						return false;
+					}
+					cp = (cp << 6) | (cc & 0x3F);
+				}
+				// Reject overlong forms, surrogates and values past U+10FFFF.
+				if ((len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000)
+					|| (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+					return false;
+				}
+				i += len;
+			}
+			return true;
+		}
+
+	private:
+		static const_char_ptr from(PCRE2_SPTR8 pointer)
+		{
+			return reinterpret_cast<const_char_ptr>(pointer);
+		}
+
+		static PCRE2_SPTR8 to(const_char_ptr pointer)
+		{
+			return reinterpret_cast<PCRE2_SPTR8>(pointer);
+		}
+	};
+
+	template<typename CharT> struct traits<CharT, 2>
+	{
+		typedef ::pcre2_code_16 code_type;
+		typedef ::pcre2_general_context_16 general_context_type;
+		typedef ::pcre2_compile_context_16 compile_context_type;
+		typedef ::pcre2_match_context_16 match_context_type;
+		typedef ::pcre2_callout_block_16 callout_block_type;
+		typedef ::pcre2_match_data_16 match_data_type;
+		typedef ::pcre2_jit_stack_16 jit_stack_type;
+
+		typedef CharT* char_ptr;
+		typedef const CharT* const_char_ptr;
+
+		static code_type* compile(std::basic_string_view<CharT> pattern, uint32_t options,
+			int* error, size_t* offset, compile_context_type* ctx)
+		{
+			return ::pcre2_compile_16(to(pattern.data()), pattern.size(), options, error, offset, ctx);
+		}
+
+		static void release(code_type* code)
+		{
+			::pcre2_code_free_16(code);
+		}
+
+		static int jit_compile(code_type* code, uint32_t options)
+		{
+			return ::pcre2_jit_compile_16(code, options);
+		}
+
+		static int query(const code_type* code, uint32_t what, void* where)
+		{
+			return ::pcre2_pattern_info_16(code, what, where);
+		}
+
+		static int config(uint32_t what, void* where)
+		{
+			return ::pcre2_config_16(what, where);
+		}
+
+		static general_context_type* general_context_create(
+			void* (*allocate)(size_t, void*), void (*deallocate)(void*, void*), void* data)
+		{
+			return ::pcre2_general_context_create_16(allocate, deallocate, data);
+		}
+
+		static void general_context_free(general_context_type* ctx)
+		{
+			::pcre2_general_context_free_16(ctx);
+		}
+
+		static compile_context_type* compile_context_create(general_context_type* gctx)
+		{
+			return ::pcre2_compile_context_create_16(gctx);
+		}
+
+		static void compile_context_free(compile_context_type* ctx)
+		{
+			::pcre2_compile_context_free_16(ctx);
+		}
+
+		static int set_newline(compile_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_newline_16(ctx, value);
+		}
+
+		static match_context_type* match_context_create(general_context_type* gctx)
+		{
+			return ::pcre2_match_context_create_16(gctx);
+		}
+
+		static void match_context_free(match_context_type* ctx)
+		{
+			::pcre2_match_context_free_16(ctx);
+		}
+
+		static match_data_type* match_data_create_from_pattern(const code_type* code, general_context_type* gctx)
+		{
+			return ::pcre2_match_data_create_from_pattern_16(code, gctx);
+		}
+
+		static match_data_type* match_data_create(uint32_t pairs, general_context_type* gctx)
+		{
+			return ::pcre2_match_data_create_16(pairs, gctx);
+		}
+
+		static void match_data_free(match_data_type* data)
+		{
+			::pcre2_match_data_free_16(data);
+		}
+
+		static const size_t* ovector_pointer(match_data_type* data)
+		{
+			return ::pcre2_get_ovector_pointer_16(data);
+		}
+
+		static uint32_t ovector_count(match_data_type* data)
+		{
+			return ::pcre2_get_ovector_count_16(data);
+		}
+
+		/// The name of the last `(*MARK)` passed on the way to the match,
+		/// or NULL if there was none.
+		static const CharT* get_mark(match_data_type* data)
+		{
+			return reinterpret_cast<const CharT*>(::pcre2_get_mark_16(data));
+		}
+
+		static jit_stack_type* jit_stack_create(size_t start, size_t max, general_context_type* gctx)
+		{
+			return ::pcre2_jit_stack_create_16(start, max, gctx);
+		}
+
+		static void jit_stack_free(jit_stack_type* stack)
+		{
+			::pcre2_jit_stack_free_16(stack);
+		}
+
+		static void jit_stack_assign(match_context_type* ctx, jit_stack_type* stack)
+		{
+			::pcre2_jit_stack_assign_16(ctx, nullptr, stack);
+		}
+
+		static int set_callout(match_context_type* ctx, int (*callout)(callout_block_type*, void*), void* data)
+		{
+			return ::pcre2_set_callout_16(ctx, callout, data);
+		}
+
+		static int set_match_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_match_limit_16(ctx, value);
+		}
+
+		static int set_depth_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_depth_limit_16(ctx, value);
+		}
+
+		static int set_heap_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_heap_limit_16(ctx, value);
+		}
+
+		static int execute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx)
+		{
+			return ::pcre2_match_16(code, to(subject.data()), subject.size(), start, options, data, ctx);
+		}
+
+		static int dfa_execute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx,
+			int* workspace, size_t workspace_len)
+		{
+			return ::pcre2_dfa_match_16(code, to(subject.data()), subject.size(), start, options,
+				data, ctx, workspace, workspace_len);
+		}
+
+		static int substitute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx,
+			std::basic_string_view<CharT> replacement, char_ptr output, size_t* output_length)
+		{
+			return ::pcre2_substitute_16(code, to(subject.data()), subject.size(), start, options,
+				data, ctx, to(replacement.data()), replacement.size(),
+				reinterpret_cast<PCRE2_UCHAR16*>(output), output_length);
+		}
+
+		static int error_message(int code, char_ptr buffer, size_t size)
+		{
+			return ::pcre2_get_error_message_16(code, reinterpret_cast<PCRE2_UCHAR16*>(buffer), size);
+		}
+
+		/// The number of code units at the start of a name table entry that
+		/// hold the group number.
+		static constexpr size_t table_offset()
+		{
+			return 1;
+		}
+
+		static size_t group_number(const_char_ptr entry)
+		{
+			return static_cast<size_t>(static_cast<uint16_t>(entry[0]));
+		}
+
+		/// Returns true if `c` continues a character rather than starting one.
+		static constexpr bool is_continuation(CharT c)
+		{
+			auto u = static_cast<uint16_t>(c);
+			return u >= 0xDC00 && u <= 0xDFFF;
+		}
+
+		/// The most code units one character takes.
+		static constexpr size_t max_char_len()
+		{
+			return 2;
+		}
+
+		/// Returns how many code units at the end of `s` belong to a
+		/// character that is cut off.
+		static size_t incomplete_suffix(std::basic_string_view<CharT> s)
+		{
+			if (s.empty()) {
+				return 0;
+			}
+			auto c = static_cast<uint16_t>(s.back());
+			return c >= 0xD800 && c <= 0xDBFF ? 1 : 0;
+		}
+
+		/// Returns the offset just past the character starting at `at`. This
+		/// never reads out of bounds, even if the subject is not valid UTF-16.
+		static size_t next_char(std::basic_string_view<CharT> subject, size_t at)
+		{
+			auto c = static_cast<uint16_t>(subject[at]);
+			if (c >= 0xD800 && c <= 0xDBFF && at + 1 < subject.size()) {
+				auto d = static_cast<uint16_t>(subject[at + 1]);
+				if (d >= 0xDC00 && d <= 0xDFFF) {
+					return at + 2;
+				}
+			}
+			return at + 1;
+		}
+
+		/// Returns true if the given string is valid UTF-16.
+		static bool valid_utf(std::basic_string_view<CharT> s)
+		{
+			for (size_t i = 0; i < s.size(); i++) {
+				auto c = static_cast<uint16_t>(s[i]);
+				if (c >= 0xDC00 && c <= 0xDFFF) {
+					return false;
+				}
+				if (c >= 0xD800 && c <= 0xDBFF) {
+					if (i + 1 >= s.size()) {
+						return false;
+					}
+					auto d = static_cast<uint16_t>(s[i + 1]);
+					if (d < 0xDC00 || d > 0xDFFF) {
+						return false;
+					}
+					i += 1;
+				}
+			}
+			return true;
+		}
+
+	private:
+		static const_char_ptr from(PCRE2_SPTR16 pointer)
+		{
+			return reinterpret_cast<const_char_ptr>(pointer);
+		}
+
+		static PCRE2_SPTR16 to(const_char_ptr pointer)
+		{
+			return reinterpret_cast<PCRE2_SPTR16>(pointer);
+		}
+	};
+
+	template<typename CharT> struct traits<CharT, 4>
+	{
+		typedef ::pcre2_code_32 code_type;
+		typedef ::pcre2_general_context_32 general_context_type;
+		typedef ::pcre2_compile_context_32 compile_context_type;
+		typedef ::pcre2_match_context_32 match_context_type;
+		typedef ::pcre2_callout_block_32 callout_block_type;
+		typedef ::pcre2_match_data_32 match_data_type;
+		typedef ::pcre2_jit_stack_32 jit_stack_type;
+
+		typedef CharT* char_ptr;
+		typedef const CharT* const_char_ptr;
+
+		static code_type* compile(std::basic_string_view<CharT> pattern, uint32_t options,
+			int* error, size_t* offset, compile_context_type* ctx)
+		{
+			return ::pcre2_compile_32(to(pattern.data()), pattern.size(), options, error, offset, ctx);
+		}
+
+		static void release(code_type* code)
+		{
+			::pcre2_code_free_32(code);
+		}
+
+		static int jit_compile(code_type* code, uint32_t options)
+		{
+			return ::pcre2_jit_compile_32(code, options);
+		}
+
+		static int query(const code_type* code, uint32_t what, void* where)
+		{
+			return ::pcre2_pattern_info_32(code, what, where);
+		}
+
+		static int config(uint32_t what, void* where)
+		{
+			return ::pcre2_config_32(what, where);
+		}
+
+		static general_context_type* general_context_create(
+			void* (*allocate)(size_t, void*), void (*deallocate)(void*, void*), void* data)
+		{
+			return ::pcre2_general_context_create_32(allocate, deallocate, data);
+		}
+
+		static void general_context_free(general_context_type* ctx)
+		{
+			::pcre2_general_context_free_32(ctx);
+		}
+
+		static compile_context_type* compile_context_create(general_context_type* gctx)
+		{
+			return ::pcre2_compile_context_create_32(gctx);
+		}
+
+		static void compile_context_free(compile_context_type* ctx)
+		{
+			::pcre2_compile_context_free_32(ctx);
+		}
+
+		static int set_newline(compile_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_newline_32(ctx, value);
+		}
+
+		static match_context_type* match_context_create(general_context_type* gctx)
+		{
+			return ::pcre2_match_context_create_32(gctx);
+		}
+
+		static void match_context_free(match_context_type* ctx)
+		{
+			::pcre2_match_context_free_32(ctx);
+		}
+
+		static match_data_type* match_data_create_from_pattern(const code_type* code, general_context_type* gctx)
+		{
+			return ::pcre2_match_data_create_from_pattern_32(code, gctx);
+		}
+
+		static match_data_type* match_data_create(uint32_t pairs, general_context_type* gctx)
+		{
+			return ::pcre2_match_data_create_32(pairs, gctx);
+		}
+
+		static void match_data_free(match_data_type* data)
+		{
+			::pcre2_match_data_free_32(data);
+		}
+
+		static const size_t* ovector_pointer(match_data_type* data)
+		{
+			return ::pcre2_get_ovector_pointer_32(data);
+		}
+
+		static uint32_t ovector_count(match_data_type* data)
+		{
+			return ::pcre2_get_ovector_count_32(data);
+		}
+
+		/// The name of the last `(*MARK)` passed on the way to the match,
+		/// or NULL if there was none.
+		static const CharT* get_mark(match_data_type* data)
+		{
+			return reinterpret_cast<const CharT*>(::pcre2_get_mark_32(data));
+		}
+
+		static jit_stack_type* jit_stack_create(size_t start, size_t max, general_context_type* gctx)
+		{
+			return ::pcre2_jit_stack_create_32(start, max, gctx);
+		}
+
+		static void jit_stack_free(jit_stack_type* stack)
+		{
+			::pcre2_jit_stack_free_32(stack);
+		}
+
+		static void jit_stack_assign(match_context_type* ctx, jit_stack_type* stack)
+		{
+			::pcre2_jit_stack_assign_32(ctx, nullptr, stack);
+		}
+
+		static int set_callout(match_context_type* ctx, int (*callout)(callout_block_type*, void*), void* data)
+		{
+			return ::pcre2_set_callout_32(ctx, callout, data);
+		}
+
+		static int set_match_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_match_limit_32(ctx, value);
+		}
+
+		static int set_depth_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_depth_limit_32(ctx, value);
+		}
+
+		static int set_heap_limit(match_context_type* ctx, uint32_t value)
+		{
+			return ::pcre2_set_heap_limit_32(ctx, value);
+		}
+
+		static int execute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx)
+		{
+			return ::pcre2_match_32(code, to(subject.data()), subject.size(), start, options, data, ctx);
+		}
+
+		static int dfa_execute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx,
+			int* workspace, size_t workspace_len)
+		{
+			return ::pcre2_dfa_match_32(code, to(subject.data()), subject.size(), start, options,
+				data, ctx, workspace, workspace_len);
+		}
+
+		static int substitute(const code_type* code, std::basic_string_view<CharT> subject,
+			size_t start, uint32_t options, match_data_type* data, match_context_type* ctx,
+			std::basic_string_view<CharT> replacement, char_ptr output, size_t* output_length)
+		{
+			return ::pcre2_substitute_32(code, to(subject.data()), subject.size(), start, options,
+				data, ctx, to(replacement.data()), replacement.size(),
+				reinterpret_cast<PCRE2_UCHAR32*>(output), output_length);
+		}
+
+		static int error_message(int code, char_ptr buffer, size_t size)
+		{
+			return ::pcre2_get_error_message_32(code, reinterpret_cast<PCRE2_UCHAR32*>(buffer), size);
+		}
+
+		/// The number of code units at the start of a name table entry that
+		/// hold the group number.
+		static constexpr size_t table_offset()
+		{
+			return 1;
+		}
+
+		static size_t group_number(const_char_ptr entry)
+		{
+			return static_cast<size_t>(static_cast<uint32_t>(entry[0]));
+		}
+
+		/// Returns true if `c` continues a character rather than starting one.
+		static constexpr bool is_continuation(CharT)
+		{
+			return false;
+		}
+
+		/// The most code units one character takes.
+		static constexpr size_t max_char_len()
+		{
+			return 1;
+		}
+
+		/// Returns how many code units at the end of `s` belong to a
+		/// character that is cut off.
+		static size_t incomplete_suffix(std::basic_string_view<CharT>)
+		{
+			return 0;
+		}
+
+		/// Returns the offset just past the character starting at `at`.
+		static size_t next_char(std::basic_string_view<CharT>, size_t at)
+		{
+			return at + 1;
+		}
+
+		/// Returns true if the given string is valid UTF-32.
+		static bool valid_utf(std::basic_string_view<CharT> s)
+		{
+			for (auto ch : s) {
+				auto c = static_cast<uint32_t>(ch);
+				if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+	private:
+		static const_char_ptr from(PCRE2_SPTR32 pointer)
+		{
+			return reinterpret_cast<const_char_ptr>(pointer);
+		}
+
+		static PCRE2_SPTR32 to(const_char_ptr pointer)
+		{
+			return reinterpret_cast<PCRE2_SPTR32>(pointer);
+		}
+	};
+}
@@ -0,0 +1,88 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pcre2 {
+
+	/// Hands out the indices `[0, count)` to a fixed number of workers in
+	/// blocks.
+	///
+	/// Every worker starts out with an equal share of the indices, so that
+	/// workers mostly touch their own counter. A worker that is done with its
+	/// share steals blocks from the shares of the others, which keeps every
+	/// worker busy until all the work is handed out, however uneven the cost
+	/// of the indices is.
+	class WorkQueue
+	{
+		/// A worker's share. The owner and thieves both take blocks from
+		/// the front.
+		struct alignas(64) Share
+		{
+			std::atomic<size_t> next;
+			size_t end;
+		};
+
+		std::unique_ptr<Share[]> shares;
+		size_t workers;
+		size_t block;
+
+	public:
+		/// Splits `[0, count)` between `workers` workers, who take `block`
+		/// indices at a time.
+		WorkQueue(size_t count, size_t workers, size_t block)
+			: shares(std::make_unique<Share[]>(workers)), workers(workers), block(std::max<size_t>(block, 1))
+		{
+			for (size_t w = 0; w < workers; w++) {
+				shares[w].next.store(count / workers * w, std::memory_order_relaxed);
+				shares[w].end = w + 1 == workers ? count : count / workers * (w + 1);
+			}
+		}
+
+		WorkQueue(const WorkQueue&) = delete;
+		WorkQueue& operator=(const WorkQueue&) = delete;
+
+		/// The number of workers the indices are split between.
+		inline auto size(this const WorkQueue& self) noexcept -> size_t
+		{
+			return self.workers;
+		}
+
+		/// Takes the next block of indices for `worker`: from its own share
+		/// while there is some left, from the others after that. Returns
+		/// `nullopt` once everything has been handed out.
+		auto take(this WorkQueue& self, size_t worker) noexcept -> std::optional<std::pair<size_t, size_t>>
+		{
+			for (size_t i = 0; i < self.workers; i++) {
+				auto& share = self.shares[(worker + i) % self.workers];
+				if (share.next.load(std::memory_order_relaxed) >= share.end) {
+					continue;
+				}
+				auto begin = share.next.fetch_add(self.block, std::memory_order_relaxed);
+				if (begin < share.end) {
+					return std::make_pair(begin, std::min(begin + self.block, share.end));
+				}
+			}
+			return std::nullopt;
+		}
+
+		/// Calls `work(worker)` once for every worker, each on its own
+		/// thread, and waits for all of them. Worker 0 runs on the calling
+		/// thread.
+		template<typename F>
+		void run(this WorkQueue& self, F&& work)
+		{
+			std::vector<std::jthread> threads;
+			threads.reserve(self.workers - 1);
+			for (size_t w = 1; w < self.workers; w++) {
+				threads.emplace_back([&work, w] { work(w); });
+			}
+			work(static_cast<size_t>(0));
+		}
+	};
+}